@@ -44,6 +44,14 @@ if(AddMyPlugin)
     btt_skr_pico_10.c
     ioports.c
     ioports_analog.c
+    pwm_divider.c
+    axis_encoder.c
+    stepper_dda.c
+    laser_raster.c
+    laser_velocity.c
+    spindle_encoder.c
+    spindle_pid.c
+    step_follower.c
     tmc_uart.c
     my_plugin.c
     eeprom/eeprom_24AAxxx.c
@@ -76,6 +84,14 @@ else()
     btt_skr_pico_10.c
     ioports.c
     ioports_analog.c
+    pwm_divider.c
+    axis_encoder.c
+    stepper_dda.c
+    laser_raster.c
+    laser_velocity.c
+    spindle_encoder.c
+    spindle_pid.c
+    step_follower.c
     tmc_uart.c
     eeprom/eeprom_24AAxxx.c
     eeprom/eeprom_24LC16B.c
@@ -188,6 +204,7 @@ target_link_libraries(grblHAL PRIVATE
  embroidery
  tinyusb_device_unmarked
  pico_stdlib
+ pico_multicore
  hardware_dma
  hardware_uart
  hardware_pio
@@ -197,12 +214,21 @@ target_link_libraries(grblHAL PRIVATE
  hardware_pwm
  hardware_rtc
  hardware_clocks
+ hardware_vreg
  hardware_flash
+ hardware_interp
 %link_libraries%
 )
 
 pico_add_extra_outputs(grblHAL)
 
+# Fails the build if interrupt handlers or functions called from interrupt context are linked to flash
+add_custom_target(ram_audit ALL
+    COMMAND ${CMAKE_COMMAND} -DMAP_FILE=$<TARGET_FILE:grblHAL>.map -P ${CMAKE_CURRENT_LIST_DIR}/ram_audit.cmake
+    DEPENDS grblHAL
+    VERBATIM
+)
+
 unset(ADD_WIFI CACHE)
 unset(ADD_ETHERNET CACHE)
 unset(ADD_BLUETOOTH CACHE)
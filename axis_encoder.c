@@ -0,0 +1,281 @@
+/*
+  axis_encoder.c - PIO quadrature encoder inputs for stepper following error detection
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if AXIS_ENCODER_ENABLE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/pio.h"
+
+#include "driverPIO.pio.h"
+#include "grbl/protocol.h"
+#include "grbl/motion_control.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/report.h"
+
+#if STEP_STREAM_ENABLE
+// sys.position is updated when a tick is generated, up to two blocks of one step per tick ahead of the output.
+#define FOLLOWING_ERROR_LIMIT (ENCODER_FOLLOWING_ERROR + 2 * STEP_STREAM_BLOCK)
+#else
+#define FOLLOWING_ERROR_LIMIT ENCODER_FOLLOWING_ERROR
+#endif
+
+typedef struct {
+    uint8_t axis;
+    uint8_t pin_a;
+    uint8_t pin_b;
+    float steps_per_count;
+    const char *description_a;
+    const char *description_b;
+} encoder_cfg_t;
+
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint8_t axis;
+    int32_t steps_per_count; // Q16
+    int32_t ref_steps;
+    int32_t ref_count;
+    volatile int32_t count;
+    volatile int32_t error;
+} encoder_t;
+
+static const encoder_cfg_t encoder_cfg[] = {
+#ifdef X_ENCODER_A_PIN
+    { .axis = X_AXIS, .pin_a = X_ENCODER_A_PIN, .pin_b = X_ENCODER_B_PIN, .steps_per_count = X_ENCODER_STEPS_PER_COUNT, .description_a = "X encoder A", .description_b = "X encoder B" },
+#endif
+#ifdef Y_ENCODER_A_PIN
+    { .axis = Y_AXIS, .pin_a = Y_ENCODER_A_PIN, .pin_b = Y_ENCODER_B_PIN, .steps_per_count = Y_ENCODER_STEPS_PER_COUNT, .description_a = "Y encoder A", .description_b = "Y encoder B" },
+#endif
+#ifdef Z_ENCODER_A_PIN
+    { .axis = Z_AXIS, .pin_a = Z_ENCODER_A_PIN, .pin_b = Z_ENCODER_B_PIN, .steps_per_count = Z_ENCODER_STEPS_PER_COUNT, .description_a = "Z encoder A", .description_b = "Z encoder B" },
+#endif
+#if defined(A_AXIS) && defined(A_ENCODER_A_PIN)
+    { .axis = A_AXIS, .pin_a = A_ENCODER_A_PIN, .pin_b = A_ENCODER_B_PIN, .steps_per_count = A_ENCODER_STEPS_PER_COUNT, .description_a = "A encoder A", .description_b = "A encoder B" },
+#endif
+#if defined(B_AXIS) && defined(B_ENCODER_A_PIN)
+    { .axis = B_AXIS, .pin_a = B_ENCODER_A_PIN, .pin_b = B_ENCODER_B_PIN, .steps_per_count = B_ENCODER_STEPS_PER_COUNT, .description_a = "B encoder A", .description_b = "B encoder B" },
+#endif
+#if defined(C_AXIS) && defined(C_ENCODER_A_PIN)
+    { .axis = C_AXIS, .pin_a = C_ENCODER_A_PIN, .pin_b = C_ENCODER_B_PIN, .steps_per_count = C_ENCODER_STEPS_PER_COUNT, .description_a = "C encoder A", .description_b = "C encoder B" },
+#endif
+};
+
+#define N_ENCODERS (sizeof(encoder_cfg) / sizeof(encoder_cfg_t))
+
+static uint_fast8_t n_encoders = 0;
+static encoder_t encoder[N_ENCODERS];
+static encoder_t *volatile fault = NULL;    // Latched until next wake up
+static volatile bool running = false;
+static stepper_wake_up_ptr stepper_wake_up;
+static stepper_go_idle_ptr stepper_go_idle;
+static stepper_cycles_per_tick_ptr stepper_cycles_per_tick;
+static on_unknown_sys_command_ptr on_unknown_sys_command;
+
+static void report_following_error (void *data)
+{
+    char msg[48]; // Axis letter, text, sign, up to 10 digits and terminator
+
+    int32_t error = ((encoder_t *)data)->error;
+
+    strcpy(msg, axis_letter[((encoder_t *)data)->axis]);
+    strcat(msg, " axis following error: ");
+    if(error < 0)
+        strcat(msg, "-");
+    strcat(msg, uitoa(error < 0 ? -(uint32_t)error : (uint32_t)error));
+    strcat(msg, " steps");
+
+    report_message(msg, Message_Warning);
+}
+
+// Outputs a signed count, ftoa() loses precision above 2^24.
+static void write_int (int32_t value)
+{
+    if(value < 0)
+        hal.stream.write("-");
+    hal.stream.write(uitoa(value < 0 ? -(uint32_t)value : (uint32_t)value));
+}
+
+// Following error in steps, positive when the encoder lags the commanded position.
+static inline int32_t following_error (encoder_t *enc, int32_t count)
+{
+    return (sys.position[enc->axis] - enc->ref_steps) - (int32_t)(((int64_t)(count - enc->ref_count) * enc->steps_per_count) >> 16);
+}
+
+static void __not_in_flash_func(encoders_check)(void)
+{
+    uint_fast8_t idx = n_encoders;
+
+    do {
+        encoder_t *enc = &encoder[--idx];
+        enc->count = quadrature_encoder_get_count(enc->pio, enc->sm);
+        enc->error = following_error(enc, enc->count);
+        if(fault == NULL && abs(enc->error) > FOLLOWING_ERROR_LIMIT) {
+            fault = enc;
+            protocol_enqueue_foreground_task(report_following_error, enc);
+#if AXIS_ENCODER_ENABLE == 1
+            running = false;
+            mc_reset();
+            system_set_exec_alarm(Alarm_MotorFault);
+#endif
+        }
+    } while(idx);
+}
+
+// Resync encoder positions to the commanded position at start of motion.
+static void encodersWakeUp (void)
+{
+    uint_fast8_t idx = n_encoders;
+
+    do {
+        encoder_t *enc = &encoder[--idx];
+        enc->ref_steps = sys.position[enc->axis];
+        enc->count = enc->ref_count = quadrature_encoder_get_count(enc->pio, enc->sm);
+        enc->error = 0;
+    } while(idx);
+
+    fault = NULL;
+    running = true;
+
+    stepper_wake_up();
+}
+
+// Called by the stepper interrupt on each segment load, checks the encoders against the position at the segment boundary.
+static void __not_in_flash_func(encodersCyclesPerTick)(uint32_t cycles_per_tick)
+{
+    stepper_cycles_per_tick(cycles_per_tick);
+
+    if(running)
+        encoders_check();
+}
+
+static void __not_in_flash_func(encodersGoIdle)(bool clear_signals)
+{
+    stepper_go_idle(clear_signals);
+
+    if(running) {
+        running = false;
+        encoders_check();
+    }
+}
+
+// $ENCODERS - reports encoder position in counts and following error in steps per axis.
+static status_code_t encoders_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_OK;
+
+    if(!strcmp(line, "$ENCODERS")) {
+
+        uint_fast8_t idx;
+
+        for(idx = 0; idx < n_encoders; idx++) {
+            encoder_t *enc = &encoder[idx];
+            if(!running) { // The stepper interrupt owns the state machine RX FIFO when running
+                enc->count = quadrature_encoder_get_count(enc->pio, enc->sm);
+                enc->error = following_error(enc, enc->count);
+            }
+            hal.stream.write("[ENCODER:");
+            hal.stream.write(axis_letter[enc->axis]);
+            hal.stream.write(",");
+            write_int(enc->count);
+            hal.stream.write(",");
+            write_int(enc->error);
+            hal.stream.write("]" ASCII_EOL);
+        }
+    } else
+        retval = on_unknown_sys_command ? on_unknown_sys_command(state, line) : Status_Unhandled;
+
+    return retval;
+}
+
+// Claims the encoder inputs from the aux input pool.
+static bool claim_pins (const encoder_cfg_t *cfg)
+{
+    return aux_input_claim(cfg->pin_a, cfg->description_a) && aux_input_claim(cfg->pin_b, cfg->description_b);
+}
+
+static bool claim_sm (encoder_t *enc, int32_t *offset)
+{
+    int sm;
+    uint_fast8_t i;
+    PIO pio[] = { pio0, pio1 };
+
+    for(i = 0; i < 2; i++) {
+        if(offset[i] == -1 && !pio_can_add_program(pio[i], &quadrature_encoder_program))
+            continue;
+        if((sm = pio_claim_unused_sm(pio[i], false)) != -1) {
+            if(offset[i] == -1)
+                offset[i] = pio_add_program(pio[i], &quadrature_encoder_program);
+            enc->pio = pio[i];
+            enc->sm = (uint)sm;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Called from driver_init() after the aux inputs are registered and the driver state machines are claimed.
+void axis_encoder_init (void)
+{
+    uint_fast8_t idx;
+    int32_t offset[2] = { -1, -1 };
+
+    if(!(hal.port.get_pin_info && hal.port.claim))
+        return;
+
+    for(idx = 0; idx < N_ENCODERS; idx++) {
+
+        const encoder_cfg_t *cfg = &encoder_cfg[idx];
+        encoder_t *enc = &encoder[n_encoders];
+
+        if(!claim_pins(cfg))
+            continue;
+
+        if(!claim_sm(enc, offset)) {
+            protocol_enqueue_foreground_task(report_plain, "Axis encoders: no free PIO state machine");
+            break;
+        }
+
+        enc->axis = cfg->axis;
+        enc->steps_per_count = (int32_t)(cfg->steps_per_count * 65536.0f);
+        quadrature_encoder_program_init(enc->pio, enc->sm, offset[pio_get_index(enc->pio)], cfg->pin_a, cfg->pin_b);
+        n_encoders++;
+    }
+
+    if(n_encoders) {
+
+        stepper_wake_up = hal.stepper.wake_up;
+        hal.stepper.wake_up = encodersWakeUp;
+
+        stepper_go_idle = hal.stepper.go_idle;
+        hal.stepper.go_idle = encodersGoIdle;
+
+        stepper_cycles_per_tick = hal.stepper.cycles_per_tick;
+        hal.stepper.cycles_per_tick = encodersCyclesPerTick;
+
+        on_unknown_sys_command = grbl.on_unknown_sys_command;
+        grbl.on_unknown_sys_command = encoders_command;
+    }
+}
+
+#endif // AXIS_ENCODER_ENABLE
@@ -32,17 +32,26 @@
 #include "hardware/timer.h"
 #include "hardware/irq.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
 #include "hardware/pwm.h"
 #include "hardware/clocks.h"
 #include "hardware/spi.h"
 #include "hardware/rtc.h"
 #include "hardware/structs/systick.h"
+#include "hardware/structs/scb.h"
 #include "hardware/structs/iobank0.h"
 #include "hardware/structs/sio.h"
+#include "hardware/sync.h"
+#include "hardware/vreg.h"
+
+#if STEPPER_CORE1_ENABLE
+#include "pico/multicore.h"
+#endif
 
 #include "driver.h"
 #include "serial.h"
+#include "pwm_divider.h"
 #include "driverPIO.pio.h"
 #include "ws2812.pio.h"
 
@@ -52,6 +61,7 @@
 #include "grbl/motor_pins.h"
 #include "grbl/pin_bits_masks.h"
 #include "grbl/protocol.h"
+#include "grbl/report.h"
 
 #ifdef I2C_PORT
 #include "i2c.h"
@@ -72,6 +82,10 @@
 #include "usb_serial.h"
 #endif
 
+#if STEPPER_DDA_ENABLE
+#include "stepper_dda.h"
+#endif
+
 #if EEPROM_ENABLE
 #include "eeprom/eeprom.h"
 #endif
@@ -109,29 +123,61 @@
 #include "bluetooth.h"
 #endif
 
-#ifdef GPIO_PIO_1
-static uint x_step_sm;
-static uint y_step_sm;
-static uint z_step_sm;
-static PIO z_step_pio;
-#ifdef X2_STEP_PIN
-static uint x2_step_sm;
-#endif
-#ifdef Y2_STEP_PIN
-static uint y2_step_sm;
-#endif
-#ifdef Z2_STEP_PIN
-static uint z2_step_sm;
-#endif
+#if STEP_PORT == GPIO_PIO_1
+
+// Step pins are grouped in 16 pin windows, each group is driven by a single state machine.
+// The pin images for all axis step masks are precomputed so all edges in a group are output in the same PIO cycle.
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint offset;        // Program offset
+    uint base;
+    uint32_t pins;      // Step pins in group
+    uint16_t idle;      // Step pin image at idle level
+    uint16_t map[64];   // Step pin image per X, Y, Z, A, B and C step mask, built by build_luts()
+    uint16_t map2[8];   // Step pin image per X2, Y2 and Z2 step mask, built by build_luts()
+} step_sm_t;
+
+static uint_fast8_t n_step_sm = 0;
+static step_sm_t step_sm[N_AXIS + N_GANGED];
+
+static const uint8_t step_pin[] = {
+    X_STEP_PIN, Y_STEP_PIN, Z_STEP_PIN,
 #ifdef A_STEP_PIN
-static uint a_step_sm;
+    A_STEP_PIN,
+#else
+    0xFF,
 #endif
 #ifdef B_STEP_PIN
-static uint b_step_sm;
+    B_STEP_PIN,
+#else
+    0xFF,
 #endif
 #ifdef C_STEP_PIN
-static uint c_step_sm;
+    C_STEP_PIN,
+#else
+    0xFF,
 #endif
+};
+
+static const uint8_t step2_pin[] = {
+#ifdef X2_STEP_PIN
+    X2_STEP_PIN,
+#else
+    0xFF,
+#endif
+#ifdef Y2_STEP_PIN
+    Y2_STEP_PIN,
+#else
+    0xFF,
+#endif
+#ifdef Z2_STEP_PIN
+    Z2_STEP_PIN,
+#else
+    0xFF,
+#endif
+};
+
 #endif
 
 #ifdef NEOPIXELS_PIN
@@ -181,14 +227,166 @@ static spindle_id_t spindle_id = -1;
 #if DRIVER_SPINDLE_PWM_ENABLE
 static bool pwmEnabled = false;
 static spindle_pwm_t spindle_pwm;
+static pwm_divider_t spindle_pwm_div;
 #define pwm(s) ((spindle_pwm_t *)s->context)
 #endif
 
+#if STEP_STREAM_ENABLE
+
+#if !(STEP_PORT == GPIO_PIO && DIRECTION_PORT == GPIO_OUTPUT)
+#error "Step streaming requires PIO step outputs and GPIO direction outputs!"
+#endif
+
+#if STEP_INJECT_ENABLE
+#error "Step injection is not supported in step streaming mode!"
+#endif
+
+#if defined(PROBE_PIN) && !PROBE_LATCH_ENABLE
+#error "Step streaming requires PROBE_LATCH_ENABLE with a probe input, the probe position is otherwise taken up to two blocks ahead of the output!"
+#endif
+
+#define STEP_STREAM_TICK_CYCLES 18  // PIO cycles per tick not spent in the step_stream delay loops.
+#define STEP_STREAM_TICK_MAX    48  // Max. number of words for a single tick, the 1000000 cycles max period is split in up to 16 ticks.
+#define STEP_STREAM_BLOCK_WORDS (STEP_STREAM_BLOCK * 3 + STEP_STREAM_TICK_MAX)
+
+// The core stepper interrupt is run a block of ticks ahead of the output, triggered by the DMA completion interrupt.
+// Step and direction pin images are relative to the lowest step or direction pin.
+typedef struct {
+    uint sm;
+    uint offset;
+    uint base;
+    uint shift;
+    uint dma_channel;
+    volatile bool running;
+    volatile bool busy;
+    bool filling;               // Core stepper interrupt handler is being run by stepStreamFill()
+    uint_fast8_t active;
+    uint32_t period;
+    uint32_t dir;
+    uint32_t step;
+    uint32_t step_idle;
+    volatile uint32_t words[2];
+    uint32_t block[2][STEP_STREAM_BLOCK_WORDS];
+} step_stream_t;
+
+static step_stream_t stream = {0};
+
+#if SYNC_OUTPUT_ENABLE
+
+#ifndef SYNC_OUTPUT_QUEUE_SIZE
+#define SYNC_OUTPUT_QUEUE_SIZE 16 // Must be a power of 2
+#endif
+
+#define STEP_STREAM_SYNC (1u << 31) // Marks a tick with synchronized output changes, bit 31 of the first tick word.
+
+#if STEPPER_CORE1_ENABLE
+#define STEPPER_CORE 1
+#else
+#define STEPPER_CORE 0
+#endif
+
+typedef struct {
+    uint8_t port;
+    bool on;
+    bool last;                  // Last change for the marked tick
+} sync_output_t;
+
+// Single producer (stepStreamFill), single consumer (sync_output_irq) queue of output changes.
+static struct {
+    volatile uint_fast8_t head;
+    volatile uint_fast8_t tail;
+    bool pending;               // Changes queued for the tick being generated
+    uint32_t spacing;           // PIO cycles since the last marked tick
+    uint32_t overruns;
+    digital_out_ptr digital_out;
+    sync_output_t queue[SYNC_OUTPUT_QUEUE_SIZE];
+} sync_out = {0};
+
+#endif // SYNC_OUTPUT_ENABLE
+
+#endif // STEP_STREAM_ENABLE
+
 static pio_steps_t pio_steps = {.delay = 20, .length = 100};
+
+#if STEP_PULSE_AXIS_ENABLE
+
+#if STEP_PORT != GPIO_PIO || STEP_STREAM_ENABLE
+#error "Per axis step pulse timing requires N_AXIS pin PIO step outputs and is not available in step streaming mode!"
+#endif
+
+#include "grbl/nvs_buffer.h"
+
+// Per axis step pulse timing, the step_pulse_axis program outputs a sequence of pin images at the stage times.
+// Stage times are the union of the pulse start (dir to step delay) and pulse end times of all axes, the stepper
+// interrupt masks the axes that are active in each stage with the axes to step and looks up the pin images.
+
+typedef struct {
+    float pulse_length[N_AXIS];     // Microseconds, 0 for $0
+    float pulse_delay[N_AXIS];      // Microseconds, 0 for $29
+} step_axis_settings_t;
+
+typedef struct {
+    uint8_t wait;                   // PIO counts - 4 from the start of the previous stage
+    uint8_t active;                 // Axes with the step output active in the stage
+} step_axis_stage_t;
+
+static struct {
+#if STEPPER_CORE1_ENABLE
+    spin_lock_t *lock;              // The stage table is changed from core 0 while core 1 outputs steps from it
+#endif
+    uint_fast8_t n_stages;          // Always even, two stages per FIFO word
+    step_axis_stage_t stage[N_AXIS * 2];
+} step_axis = { .n_stages = 2, .stage = { { .wait = 16, .active = AXES_BITMASK }, { .wait = 96, .active = 0 } } };
+
+#if STEPPER_CORE1_ENABLE
+#define STEP_AXIS_LOCK() uint32_t irq_state = spin_lock_blocking(step_axis.lock)
+#define STEP_AXIS_UNLOCK() spin_unlock(step_axis.lock, irq_state)
+#else
+#define STEP_AXIS_LOCK() uint32_t irq_state = save_and_disable_interrupts()
+#define STEP_AXIS_UNLOCK() restore_interrupts(irq_state)
+#endif
+
+static nvs_address_t step_axis_nvs;
+static step_axis_settings_t step_axis_settings;
+
+#endif // STEP_PULSE_AXIS_ENABLE
+#if STEP_INJECT_ENABLE
+
+#ifndef STEP_INJECT_QUEUE_SIZE
+#define STEP_INJECT_QUEUE_SIZE 32 // Must be a power of 2
+#endif
+#ifndef STEP_INJECT_WAIT
+#define STEP_INJECT_WAIT 2000 // Max. microseconds a thread context caller waits for room in a full queue
+#endif
+
+typedef struct {
+    axes_signals_t step;
+    axes_signals_t dir;
+    bool position;              // Update the machine position when output
+} step_inject_t;
+
+// Single producer (stepper_inject_step), single consumer (stepper interrupt) queue of injected steps.
+// The stepper timer is kept running while the queue is not empty, in drain mode when there is no motion.
+static struct {
+    volatile uint_fast8_t head;
+    volatile uint_fast8_t tail;
+    volatile bool drain;        // Stepper timer outputs queued steps only
+    volatile uint32_t overruns;
+    uint32_t drain_period;      // Stepper timer ticks between queued steps output in drain mode
+    axes_signals_t dir;         // Direction of main motion
+    axes_signals_t dir_out;     // Direction signals as last output
+    axes_signals_t moving;      // Axes moved by the main motion block being executed
+    step_inject_t queue[STEP_INJECT_QUEUE_SIZE];
+} step_inject = {0};
+
+#endif
+#if STEP_SELFTEST_ENABLE
+static int16_t pulse_length_adj = 0, pulse_delay_adj = 0; // Step pulse PIO count corrections from $STEPTEST=C
+#endif
 static uint stepper_timer_sm, stepper_timer_sm_offset;
 static uint16_t pulse_length, pulse_delay;
 static bool IOInitDone = false;
-static status_code_t (*on_unknown_sys_command)(uint_fast16_t state, char *line, char *lcline);
+static on_unknown_sys_command_ptr on_unknown_sys_command;
 static volatile uint32_t elapsed_ticks = 0;
 static probe_state_t probe = { .connected = On };
 static pin_group_pins_t limit_inputs;
@@ -301,7 +499,36 @@ static input_signal_t inputpin[] = {
 };
 
 
-#if STEP_PORT == GPIO_SR8
+#if SD_SHIFT_REGISTER == 16
+
+// Two chained shift registers for up to 8 motors, the board map defines the register image types and the step
+// and direction pins of all motors as bit numbers in the 16 bit register image, see generic_sr16_map.h.
+
+#if N_ABC_MOTORS > 5
+#error "Axis configuration is not supported!"
+#endif
+
+#if !(STEP_PORT == GPIO_SR8 && DIRECTION_PORT == GPIO_SR8)
+#error "Step and direction signals must both be output via the shift registers!"
+#endif
+
+#if (defined(A_AXIS) && !(defined(A_STEP_PIN) && defined(A_DIRECTION_PIN))) || \
+    (defined(B_AXIS) && !(defined(B_STEP_PIN) && defined(B_DIRECTION_PIN))) || \
+    (defined(C_AXIS) && !(defined(C_STEP_PIN) && defined(C_DIRECTION_PIN))) || \
+    (X_GANGED && !(defined(X2_STEP_PIN) && defined(X2_DIRECTION_PIN))) || \
+    (Y_GANGED && !(defined(Y2_STEP_PIN) && defined(Y2_DIRECTION_PIN))) || \
+    (Z_GANGED && !(defined(Z2_STEP_PIN) && defined(Z2_DIRECTION_PIN)))
+#error "Board map does not define the step and direction pins of all motors!"
+#endif
+
+#define SD_SR_STEP_BITS  0x00FF
+#define SD_SR_DIR_BITS   0xFF00
+
+#elif STEP_PORT == GPIO_SR8
+
+#define SD_SR_STEP_BITS  0xF0
+#define SD_SR_DIR_BITS   0x0F
+
 #if N_ABC_MOTORS > 1
 #error "Axis configuration is not supported!"
 #endif
@@ -326,7 +553,7 @@ static input_signal_t inputpin[] = {
 #endif
 #endif
 
-#if DIRECTION_PORT == GPIO_SR8
+#if DIRECTION_PORT == GPIO_SR8 && SD_SHIFT_REGISTER != 16
 #if N_ABC_MOTORS > 1
 #error "Axis configuration is not supported!"
 #endif
@@ -471,7 +698,7 @@ static output_signal_t outputpin[] = {
 #ifdef SPI_RST_PIN
     { .id = Output_SPIRST,       .port = SPI_RST_PORT,     .pin = SPI_RST_PIN,           .group = PinGroup_SPI },
 #endif
-#ifndef SD_SHIFT_REGISTER
+#if !OUT_SHIFT_REGISTER
 #ifdef SPINDLE_ENABLE_PIN
     { .id = Output_SpindleOn,    .port = SPINDLE_PORT,     .pin = SPINDLE_ENABLE_PIN,    .group = PinGroup_SpindleControl},
 #endif
@@ -523,7 +750,7 @@ static output_signal_t outputpin[] = {
 #ifdef AUXOUTPUT7_PORT
     { .id = Output_Aux7,         .port = AUXOUTPUT7_PORT,  .pin = AUXOUTPUT7_PIN,        .group = PinGroup_AuxOutput},
 #endif
-#else // SD_SHIFT_REGISTER pin definitions - for $pins command only
+#else // OUT_SHIFT_REGISTER pin definitions - for $pins command only
     { .id = Output_SpindleOn,    .port = GPIO_SR16, .pin = 4,  .group = PinGroup_SpindleControl },
     { .id = Output_SpindleDir,   .port = GPIO_SR16, .pin = 5,  .group = PinGroup_SpindleControl },
     { .id = Output_CoolantFlood, .port = GPIO_SR16, .pin = 6,  .group = PinGroup_Coolant },
@@ -539,7 +766,7 @@ static output_signal_t outputpin[] = {
     { .id = Output_Aux7,         .port = AUXOUTPUT7_PORT, .pin = AUXOUTPUT7_PIN, .group = PinGroup_AuxOutput},
 #endif
     { .id = Output_SPIRST,       .port = GPIO_SR16, .pin = 15, .group = PinGroup_SPI },
-#endif // SD_SHIFT_REGISTER
+#endif // OUT_SHIFT_REGISTER
 #ifdef AUXOUTPUT0_PWM_PIN
     { .id = Output_Analog_Aux0, .port = GPIO_OUTPUT, .pin = AUXOUTPUT0_PWM_PIN, .group = PinGroup_AuxOutputAnalog, .mode = { PINMODE_PWM } },
 #endif
@@ -575,6 +802,18 @@ static output_signal_t outputpin[] = {
 #define DEBOUNCE_DELAY 40 // ms
 #endif
 
+// PIO state machine clocks, dividers are derived from the system clock set by SYS_CLOCK_KHZ.
+#define STEP_TIMER_CLOCK 10000000   // Hz, stepper timer and step pulse delay and length
+#define SR_DELAY_CLOCK   10729614   // Hz, step_dir_sr4 dir to step delay and pulse length, faster than the step timer to compensate for the program overhead
+#define SR_SHIFT_CLOCK   125000000  // Hz, max. shift register clock, T3 gives 48 ns clock and latch pulses
+#define PPI_PIO_CLOCK    10000000   // Hz, PPI laser pulse length
+
+// Returns the PIO clock divider for the state machine clock in Hz.
+static inline float pio_clkdiv (uint32_t hz)
+{
+    return (float)clock_get_hz(clk_sys) / (float)hz;
+}
+
 /*
 #define DEBOUNCE_ALARM_HW_TIMER 0   // Hardware alarm timer 0 used for the debounce alarm pool
 #define DEBOUNCE_ALARM_MAX_TIMER 16 // Maximum number of alarm timer in the debounce alarm pool (based on SDK 'PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS 16' for default pool used for driver_delay in driver.c)
@@ -594,13 +833,197 @@ static step_dir_sr_t sd_sr;
 #endif
 
 #if OUT_SHIFT_REGISTER
-static uint32_t out_sr_sm;
+
+// The output shift register is written from the out_sr shadow register by the lowest priority interrupt, pended when
+// the shadow register is released after a change. Changes are made between out_sr_hold() and out_sr_release(), nested
+// holds are output with a single write. Getters read the shadow register.
+// The shadow register is changed from both cores when the stepper interrupt runs on core 1, holding it takes a hardware
+// spin lock with interrupts disabled on the calling core. The flush interrupt takes the lock to read it.
 static output_sr_t out_sr;
-#endif
+static struct {
+    uint32_t sm;
+    uint irq;
+    spin_lock_t *lock;
+    uint32_t irq_state;             // Interrupt state of the holding core, restored on release
+    volatile uint_fast8_t hold;     // Hold nesting level
+    volatile uint_fast8_t owner;    // Core holding the shadow register
+    volatile bool dirty;
+    volatile bool ready;            // State machine initialized
+    volatile uint32_t updates;
+    volatile uint32_t writes;
+} out_sr_ctl = {
+    .owner = 0xFF
+};
+
+static void __not_in_flash_func(out_sr_flush_irq)(void)
+{
+    uint32_t irq_state = spin_lock_blocking(out_sr_ctl.lock);
+
+    if(out_sr_ctl.dirty && out_sr_ctl.ready) {
+        out_sr_ctl.dirty = false;
+        out_sr_ctl.writes++;
+        out_sr16_write(pio1, out_sr_ctl.sm, out_sr.value);
+    }
+
+    spin_unlock(out_sr_ctl.lock, irq_state);
+}
+
+// Call before the shadow register is changed.
+void __not_in_flash_func(out_sr_hold)(void)
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    // Interrupts are disabled while held so only a nested hold can find this core as the owner.
+    if(out_sr_ctl.owner != get_core_num()) {
+        spin_lock_unsafe_blocking(out_sr_ctl.lock);
+        out_sr_ctl.owner = get_core_num();
+        out_sr_ctl.irq_state = irq_state;
+    }
+
+    out_sr_ctl.hold++;
+}
+
+// Call after the shadow register is changed.
+void __not_in_flash_func(out_sr_update)(void)
+{
+    out_sr_ctl.updates++;
+    out_sr_ctl.dirty = true;
+}
+
+// Releases the shadow register, the flush interrupt is pended on the calling core when the last hold is released.
+void __not_in_flash_func(out_sr_release)(void)
+{
+    if(--out_sr_ctl.hold == 0) {
+
+        bool flush = out_sr_ctl.dirty && out_sr_ctl.ready;
+        uint32_t irq_state = out_sr_ctl.irq_state;
+
+        out_sr_ctl.owner = 0xFF;
+        spin_unlock_unsafe(out_sr_ctl.lock);
+        restore_interrupts(irq_state);
+
+        if(flush)
+            irq_set_pending(out_sr_ctl.irq);
+    }
+}
+
+// User interrupts are core local, the handler is enabled on core 1 too when it runs the stepper interrupt.
+static void out_sr_flush_init (void)
+{
+    out_sr_ctl.lock = spin_lock_init(spin_lock_claim_unused(true));
+    out_sr_ctl.irq = (uint)user_irq_claim_unused(true);
+    irq_set_exclusive_handler(out_sr_ctl.irq, out_sr_flush_irq);
+    irq_set_priority(out_sr_ctl.irq, PICO_LOWEST_IRQ_PRIORITY);
+    irq_set_enabled(out_sr_ctl.irq, true);
+}
+
+// $OUTSR - reports the number of shadow register updates, shift register writes and updates merged into other writes.
+static status_code_t out_sr_report (sys_state_t state)
+{
+    UNUSED(state);
+
+    uint32_t updates = out_sr_ctl.updates, writes = out_sr_ctl.writes;
+
+    hal.stream.write("[OUTSR:");
+    hal.stream.write(uitoa(updates));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(writes));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(updates - writes));
+    hal.stream.write("]" ASCII_EOL);
+
+    return Status_OK;
+}
+
+#if OUT_SR_REFRESH_ENABLE
+
+static const uint32_t *out_sr_refresh_src = &out_sr.value;
+
+// Rewrites the shift register from the shadow register at clk_sys / 65535, about 1.9 kHz at 125 MHz, to restore outputs
+// corrupted by noise. The data channel is paced by a DMA timer and chains to a control channel that restarts it.
+static void out_sr_refresh_init (void)
+{
+    int timer, data, ctrl;
+    dma_channel_config config;
+
+    if((timer = dma_claim_unused_timer(false)) == -1 || (data = dma_claim_unused_channel(false)) == -1 || (ctrl = dma_claim_unused_channel(false)) == -1) {
+        if(timer != -1) {
+            if(data != -1)
+                dma_channel_unclaim(data);
+            dma_timer_unclaim(timer);
+        }
+        protocol_enqueue_foreground_task(report_plain, "Output shift register refresh: no free DMA channels");
+        return;
+    }
+
+    dma_timer_set_fraction(timer, 1, 0xFFFF);
+
+    config = dma_channel_get_default_config(ctrl);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, false);
+    dma_channel_configure(ctrl, &config, &dma_hw->ch[data].al3_read_addr_trig, &out_sr_refresh_src, 1, false);
+
+    config = dma_channel_get_default_config(data);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, dma_get_timer_dreq(timer));
+    channel_config_set_chain_to(&config, ctrl);
+    dma_channel_configure(data, &config, &pio1->txf[out_sr_ctl.sm], &out_sr.value, 1, true);
+}
+
+#endif // OUT_SR_REFRESH_ENABLE
+
+#endif // OUT_SHIFT_REGISTER
 
 static void systick_handler(void);
 static void stepper_int_handler(void);
 static void gpio_int_handler(uint gpio, uint32_t events);
+static void gpio_irq_init(void);
+
+#if STEPPER_CORE1_ENABLE
+
+// Stepper, GPIO and debounce interrupts are serviced by core 1, the foreground process, USB,
+// networking and file I/O run on core 0.
+// Core 0 wakes and idles the stepper timer via the PIO interrupt enable register, and
+// shared realtime flags are updated under a hardware spinlock as the M0+ has no exclusive access instructions.
+
+static spin_lock_t *atomic_lock;
+static alarm_pool_t *core1_alarm_pool;
+static volatile bool core1_ready = false;
+
+#define ATOMIC_ENTER() uint32_t irq_state = spin_lock_blocking(atomic_lock)
+#define ATOMIC_EXIT() spin_unlock(atomic_lock, irq_state)
+#define debounce_alarm_in_ms(ms, callback, data, fire_if_past) alarm_pool_add_alarm_in_ms(core1_alarm_pool, ms, callback, data, fire_if_past)
+#define gpio_irq_ctrl (&iobank0_hw->proc1_irq_ctrl)
+
+#else
+
+#define ATOMIC_ENTER() uint32_t irq_state = save_and_disable_interrupts()
+#define ATOMIC_EXIT() restore_interrupts(irq_state)
+#define debounce_alarm_in_ms(ms, callback, data, fire_if_past) add_alarm_in_ms(ms, callback, data, fire_if_past)
+#define gpio_irq_ctrl (&iobank0_hw->proc0_irq_ctrl)
+
+#endif // STEPPER_CORE1_ENABLE
+
+static uint32_t gpio_irq_mask = 0; // Input pins dispatched by gpio_irq_handler()
+
+// Enables/disables GPIO interrupts in the interrupt controller of the core servicing them regardless of the calling core.
+// Replaces gpio_set_irq_enabled() which runs from flash.
+static void __not_in_flash_func(gpio_irq_enable)(uint gpio, uint32_t events, bool enabled)
+{
+    io_rw_32 *en_reg = &gpio_irq_ctrl->inte[gpio >> 3];
+
+    events <<= 4 * (gpio & 0x07);
+
+    iobank0_hw->intr[gpio >> 3] = events; // Acknowledge pending edge events
+
+    if(enabled)
+        hw_set_bits(en_reg, events);
+    else
+        hw_clear_bits(en_reg, events);
+}
 
 #if I2C_STROBE_BIT || SPI_IRQ_BIT
 
@@ -667,7 +1090,7 @@ static void driver_delay (uint32_t ms, delay_callback_ptr callback)
 //*************************  STEPPER  *************************//
 
 // Enable/disable stepper motors
-static void stepperEnable (axes_signals_t enable)
+static void __not_in_flash_func(stepperEnable)(axes_signals_t enable)
 {
     enable.mask ^= settings.steppers.enable_invert.mask;
 #if TRINAMIC_ENABLE && TRINAMIC_I2C
@@ -701,6 +1124,7 @@ static void stepperEnable (axes_signals_t enable)
     gpio_put(STEPPERS_ENABLE_PIN, enable.x);
 #endif
 #elif ENABLE_PORT == GPIO_SR16
+    out_sr_hold();
     out_sr.x_ena = enable.x;
 #ifdef X2_ENABLE_PIN
     out_sr.m3_ena = enable.x;
@@ -716,7 +1140,8 @@ static void stepperEnable (axes_signals_t enable)
 #ifdef A_ENABLE_PIN
     out_sr.m3_ena = enable.a;
 #endif
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 #elif ENABLE_PORT == GPIO_IOEXPAND
 #ifdef STEPPERS_DISABLEX_PIN
     ioex_out(STEPPERS_DISABLEX_PIN) = enable.x;
@@ -728,127 +1153,618 @@ static void stepperEnable (axes_signals_t enable)
 #endif
 }
 
+#if STEPPER_TIMING_ENABLE
+
+// Stepper interrupt latency and execution time statistics, reported by the $STEPTIME command.
+// Timestamps are in system clock cycles from SysTick of the core servicing the stepper interrupt.
+// The stepper timer interrupt time is tracked from the programmed periods, latency is measured against it.
+
+#define TIMING_BINS 24 // log2 histogram bins, timestamp differences are modulo 2^24 cycles
+
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint32_t count;
+    uint64_t sum;
+    uint32_t histogram[TIMING_BINS];
+} timing_stats_t;
+
+static struct {
+    volatile bool reset;
+    bool valid;             // irq_next is valid
+    uint32_t ticks;         // stepper timer period as programmed, in step timer ticks
+    uint32_t irq_next;      // expected timestamp of the next stepper timer interrupt
+    uint32_t irq_period;    // stepper timer interrupt period in cycles
+    uint32_t cycles_per_tick2; // 2 x system clock cycles per step timer tick
+    uint32_t overruns;
+    timing_stats_t latency;
+    timing_stats_t exec;
+} stepper_timing;
+
+#if !STEPPER_CORE1_ENABLE
+static uint32_t systick_cycles; // SysTick reload period
+#endif
+
+// Returns a system clock cycle timestamp, only differences modulo 2^24 are valid.
+static inline uint32_t __not_in_flash_func(timing_get_cycles)(void)
+{
+#if STEPPER_CORE1_ENABLE
+    return 0xFFFFFF - systick_hw->cvr; // Core 1 SysTick is free running
+#else
+    uint32_t ticks, cvr;
+
+    do {
+        ticks = elapsed_ticks;
+        cvr = systick_hw->cvr;
+    } while(ticks != elapsed_ticks);
+
+    // SysTick wrapped while its interrupt is held off.
+    if((scb_hw->icsr & M0PLUS_ICSR_PENDSTSET_BITS) && cvr > (systick_cycles >> 1))
+        ticks++;
+
+    return ticks * systick_cycles + systick_cycles - 1 - cvr;
+#endif
+}
+
+static void __not_in_flash_func(timing_add)(timing_stats_t *stats, uint32_t cycles)
+{
+    uint_fast8_t bin = cycles ? 31 - __builtin_clz(cycles) : 0;
+
+    if(cycles < stats->min)
+        stats->min = cycles;
+    if(cycles > stats->max)
+        stats->max = cycles;
+    stats->sum += cycles;
+    stats->count++;
+    stats->histogram[bin < TIMING_BINS ? bin : TIMING_BINS - 1]++;
+}
+
+static void timing_clear (void)
+{
+    memset(&stepper_timing.latency, 0, sizeof(timing_stats_t));
+    memset(&stepper_timing.exec, 0, sizeof(timing_stats_t));
+    stepper_timing.latency.min = stepper_timing.exec.min = UINT32_MAX;
+    stepper_timing.overruns = 0;
+    stepper_timing.reset = false;
+}
+
+// Called on stepper interrupt entry.
+static inline void __not_in_flash_func(timing_enter)(uint32_t now)
+{
+    if(stepper_timing.reset)
+        timing_clear();
+
+    if(stepper_timing.valid) {
+        uint32_t latency = (now - stepper_timing.irq_next) & 0xFFFFFF;
+        timing_add(&stepper_timing.latency, latency & 0x800000 ? 0 : latency); // Early entries are due to rounding, count as zero
+        stepper_timing.irq_next += stepper_timing.irq_period;
+    }
+}
+
+// Called on stepper interrupt exit.
+static inline void __not_in_flash_func(timing_exit)(uint32_t entry)
+{
+    timing_add(&stepper_timing.exec, (timing_get_cycles() - entry) & 0xFFFFFF);
+
+    if(pio1->irq & 0x01) // Next stepper timer interrupt already pending
+        stepper_timing.overruns++;
+}
+
+// Called when the stepper timer period is set, the timer is restarted when the period is changed.
+static inline void __not_in_flash_func(timing_set_period)(uint32_t ticks, bool wake_up)
+{
+    if(wake_up)
+        stepper_timing.valid = false; // Timer may be started from the other core, sync on the first period change
+    else if(ticks != stepper_timing.ticks) {
+        // Restart executes pull, mov, mov and ticks + 1 jmp before raising irq 0, a free running period adds the irq instruction.
+        stepper_timing.irq_next = timing_get_cycles() + (((ticks + 4) * stepper_timing.cycles_per_tick2) >> 1);
+        stepper_timing.irq_period = ((ticks + 5) * stepper_timing.cycles_per_tick2) >> 1;
+        stepper_timing.valid = stepper_timing.irq_period < 0x800000;
+    }
+
+    stepper_timing.ticks = ticks;
+}
+
+static void timing_report (const char *name, timing_stats_t *stats)
+{
+    uint_fast8_t i;
+    float cycles_per_us = (float)(clock_get_hz(clk_sys) / 1000000UL);
+
+    hal.stream.write("[STEPTIME:");
+    hal.stream.write(name);
+    hal.stream.write(",");
+    hal.stream.write(uitoa(stats->count));
+    if(stats->count) {
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)stats->min / cycles_per_us, 2));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)stats->sum / (float)stats->count / cycles_per_us, 2));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)stats->max / cycles_per_us, 2));
+        hal.stream.write(",");
+        for(i = 0; i < TIMING_BINS; i++) {
+            if(i)
+                hal.stream.write("|");
+            hal.stream.write(uitoa(stats->histogram[i]));
+        }
+    }
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// $STEPTIME - reports stepper interrupt latency and execution time as count,min,mean,max in microseconds
+// followed by a histogram of counts per log2 system clock cycles bin, $STEPTIME=R resets the statistics.
+static status_code_t timing_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_OK;
+
+    if(!strcmp(line, "$STEPTIME")) {
+        timing_stats_t latency, exec;
+        uint32_t overruns = stepper_timing.overruns;
+        memcpy(&latency, &stepper_timing.latency, sizeof(timing_stats_t));
+        memcpy(&exec, &stepper_timing.exec, sizeof(timing_stats_t));
+        timing_report("LATENCY", &latency);
+        timing_report("EXEC", &exec);
+        hal.stream.write("[STEPTIME:OVERRUNS,");
+        hal.stream.write(uitoa(overruns));
+        hal.stream.write("]" ASCII_EOL);
+#if STEP_INJECT_ENABLE
+        hal.stream.write("[STEPTIME:INJECTOVERRUNS,");
+        hal.stream.write(uitoa(step_inject.overruns));
+        hal.stream.write("]" ASCII_EOL);
+#endif
+    } else if(!strcmp(line, "$STEPTIME=R")) {
+        if(pio1->ctrl & (1 << stepper_timer_sm))
+            stepper_timing.reset = true; // Cleared by the stepper interrupt
+        else
+            timing_clear();
+    } else
+        retval = Status_Unhandled;
+
+    return retval;
+}
+
+#else
+
+#define timing_set_period(ticks, wake_up)
+
+#endif // STEPPER_TIMING_ENABLE
+
 // Starts stepper driver ISR timer and forces a stepper driver interrupt callback
 static void stepperWakeUp (void)
 {
     stepperEnable((axes_signals_t){AXES_BITMASK});
+#if STEP_INJECT_ENABLE
+    ATOMIC_ENTER();
+    step_inject.drain = false; // Queued steps are merged with the motion from now on
+#endif
+    timing_set_period(hal.f_step_timer / 500, true);
     stepper_timer_set_period(pio1, stepper_timer_sm, stepper_timer_sm_offset, hal.f_step_timer / 500); // ~2ms delay to allow drivers time to wake up.
+#if !STEPPER_CORE1_ENABLE
+    irq_set_enabled(PIO1_IRQ_0, true);
+#endif
+#if STEP_INJECT_ENABLE
+    ATOMIC_EXIT();
+#endif
+}
+
+#if STEP_INJECT_ENABLE
+
+// Runs the stepper timer in drain mode, the stepper interrupt then outputs a queued step per tick
+// and stops the timer when the queue is empty. Called with the queue locked.
+static void __not_in_flash_func(stepperInjectDrainStart)(void)
+{
+    step_inject.drain = true;
+    timing_set_period(step_inject.drain_period, true);
+    stepper_timer_set_period(pio1, stepper_timer_sm, stepper_timer_sm_offset, step_inject.drain_period);
+#if !STEPPER_CORE1_ENABLE
     irq_set_enabled(PIO1_IRQ_0, true);
+#endif
 }
 
+#endif
+
 // Disables stepper driver interrupts
-static void stepperGoIdle (bool clear_signals)
+// Steps still queued for injection are output by the stepper timer in drain mode, unless the signals are to be cleared.
+// Drain mode is also used to restore the main direction signals after the last injected step.
+static void __not_in_flash_func(stepperGoIdle)(bool clear_signals)
 {
+#if STEP_INJECT_ENABLE
+    ATOMIC_ENTER();
+
+    if(clear_signals)
+        step_inject.tail = step_inject.head;
+
+    step_inject.moving.mask = 0;
+
+    if(step_inject.tail != step_inject.head || (!clear_signals && step_inject.dir_out.mask != step_inject.dir.mask))
+        stepperInjectDrainStart();
+    else {
+        step_inject.drain = false;
+#if !STEPPER_CORE1_ENABLE
+        irq_set_enabled(PIO1_IRQ_0, false);
+#endif
+        stepper_timer_stop(pio1, stepper_timer_sm);
+    }
+
+    ATOMIC_EXIT();
+#else
+#if !STEPPER_CORE1_ENABLE
     irq_set_enabled(PIO1_IRQ_0, false);
+#endif
     stepper_timer_stop(pio1, stepper_timer_sm);
+#endif
 }
 
-// Sets up stepper driver interrupt timeout, "Normal" version
-static void __not_in_flash_func(stepperCyclesPerTick)(uint32_t cycles_per_tick)
+#if STEPPER_CORE1_ENABLE
+
+// Returns true while steps are generated by core 1, flash is not written then as that pauses core 1.
+bool stepper_active (void)
 {
-    stepper_timer_set_period(pio1, stepper_timer_sm, stepper_timer_sm_offset, cycles_per_tick < 1000000 ? cycles_per_tick : 1000000);
+#if STEP_STREAM_ENABLE
+    return stream.busy;
+#else
+    return !!(pio1->ctrl & (1u << stepper_timer_sm));
+#endif
 }
 
-#ifdef SQUARING_ENABLED
-
-static axes_signals_t motors_1 = {AXES_BITMASK}, motors_2 = {AXES_BITMASK};
+#endif
 
-// Set stepper pulse output pins
-// NOTE: step_outbits are: bit0 -> X, bit1 -> Y, bit2 -> Z...
-inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_signals_t step_outbits_1)
+// Sets up stepper driver interrupt timeout, "Normal" version
+static void __not_in_flash_func(stepperCyclesPerTick)(uint32_t cycles_per_tick)
 {
-    axes_signals_t step_outbits_2;
+    if(cycles_per_tick > 1000000)
+        cycles_per_tick = 1000000;
 
-    step_outbits_2.mask = (step_outbits_1.mask & motors_2.mask) ^ settings.steppers.step_invert.mask;
-    step_outbits_1.mask = (step_outbits_1.mask & motors_1.mask) ^ settings.steppers.step_invert.mask;
+    timing_set_period(cycles_per_tick, false);
+    stepper_timer_set_period(pio1, stepper_timer_sm, stepper_timer_sm_offset, cycles_per_tick);
+}
 
-#if STEP_PORT == GPIO_PIO_1
+// Step and direction output lookup tables, indexed by axis mask with the invert masks applied.
+// Rebuilt by build_luts() from settings_changed() so the stepper interrupt only has to do a table load per output.
 
-    pio_steps.set = step_outbits_1.x;
-    pio_steps.reset = settings.steppers.step_invert.x;
-    step_pulse_generate(pio1, x_step_sm, pio_steps.value);
-#ifdef X2_STEP_PIN
-    pio_steps.set = step_outbits_2.x;
-    step_pulse_generate(pio0, x2_step_sm, pio_steps.value);
-#endif
-    pio_steps.set = step_outbits_1.y;
-    pio_steps.reset = settings.steppers.step_invert.y;
-    step_pulse_generate(pio1, y_step_sm, pio_steps.value);
-#ifdef Y2_STEP_PIN
-    pio_steps.set = step_outbits_2.y;
-    step_pulse_generate(pio0, y2_step_sm, pio_steps.value);
-#endif
-    pio_steps.set = step_outbits_1.z;
-    pio_steps.reset = settings.steppers.step_invert.z;
-    step_pulse_generate(z_step_pio, z_step_sm, pio_steps.value);
-#ifdef Z2_STEP_PIN
-    pio_steps.set = step_outbits_2.z;
-    step_pulse_generate(pio0, z2_step_sm, pio_steps.value);
+#if SD_SHIFT_REGISTER == 16
+static uint16_t step_lut[64];
+#ifdef SQUARING_ENABLED
+static uint16_t step_lut2[8]; // X2, Y2 and Z2
 #endif
-#ifdef A_STEP_PIN
-    pio_steps.set = step_outbits_1.a;
-    pio_steps.reset = settings.steppers.step_invert.a;
-    step_pulse_generate(pio0, a_step_sm, pio_steps.value);
+#elif STEP_PORT == GPIO_PIO || STEP_PORT == GPIO_SR8
+static uint8_t step_lut[64];
+#ifdef SQUARING_ENABLED
+static uint8_t step_lut2[8]; // X2, Y2 and Z2
 #endif
-#ifdef B_STEP_PIN
-    pio_steps.set = step_outbits_1.b;
-    pio_steps.reset = settings.steppers.step_invert.b;
-    step_pulse_generate(pio0, b_step_sm, pio_steps.value);
 #endif
-#ifdef C_STEP_PIN
-    pio_steps.set = step_outbits_1.c;
-    pio_steps.reset = settings.steppers.step_invert.c;
-    step_pulse_generate(pio0, c_step_sm, pio_steps.value);
+
+#if DIRECTION_PORT == GPIO_OUTPUT
+static uint32_t dir_lut[64], dir_lut_mask;
+#elif SD_SHIFT_REGISTER == 16
+static uint16_t dir_lut[64];
+#elif DIRECTION_PORT == GPIO_SR8
+static uint8_t dir_lut[64];
 #endif
 
-#elif STEP_PORT == GPIO_PIO
+#if STEP_PORT == GPIO_PIO
 
-    pio_steps.set = step_outbits_1.mask & 0x07;
+// Returns the step_pulse program pin image for the primary and ganged motors step signals.
+static uint8_t step_image (axes_signals_t step_outbits_1, axes_signals_t step_outbits_2)
+{
+    uint8_t image = step_outbits_1.mask & 0x07;
 
 #ifdef X2_STEP_PIN
     if (step_outbits_2.x)
-        pio_steps.set |= (1 << (X2_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (X2_STEP_PIN - STEP_PINS_BASE));
 #endif
 #ifdef Y2_STEP_PIN
     if (step_outbits_2.y)
-        pio_steps.set |= (1 << (Y2_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (Y2_STEP_PIN - STEP_PINS_BASE));
 #endif
 #ifdef Z2_STEP_PIN
     if (step_outbits_2.z)
-        pio_steps.set |= (1 << (Z2_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (Z2_STEP_PIN - STEP_PINS_BASE));
 #endif
 #ifdef A_STEP_PIN
     if (step_outbits_1.a)
-        pio_steps.set |= (1 << (A_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (A_STEP_PIN - STEP_PINS_BASE));
 #endif
 #ifdef B_STEP_PIN
     if (step_outbits_1.b)
-        pio_steps.set |= (1 << (B_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (B_STEP_PIN - STEP_PINS_BASE));
 #endif
 #ifdef C_STEP_PIN
     if (step_outbits_1.c)
-        pio_steps.set |= (1 << (C_STEP_PIN - STEP_PINS_BASE));
+        image |= (1 << (C_STEP_PIN - STEP_PINS_BASE));
 #endif
 
-    step_pulse_generate(pio0, 0, pio_steps.value);
+    return image;
+}
+
+#elif STEP_PORT == GPIO_SR8 && SD_SHIFT_REGISTER == 16
+
+// Returns the shift register step bits for the primary and ganged motors step signals.
+static uint16_t step_image (axes_signals_t step_outbits_1, axes_signals_t step_outbits_2)
+{
+    uint16_t image = 0;
+
+    if(step_outbits_1.x)
+        image |= 1 << X_STEP_PIN;
+    if(step_outbits_1.y)
+        image |= 1 << Y_STEP_PIN;
+    if(step_outbits_1.z)
+        image |= 1 << Z_STEP_PIN;
+#ifdef A_STEP_PIN
+    if(step_outbits_1.a)
+        image |= 1 << A_STEP_PIN;
+#endif
+#ifdef B_STEP_PIN
+    if(step_outbits_1.b)
+        image |= 1 << B_STEP_PIN;
+#endif
+#ifdef C_STEP_PIN
+    if(step_outbits_1.c)
+        image |= 1 << C_STEP_PIN;
+#endif
+#ifdef X2_STEP_PIN
+    if(step_outbits_2.x)
+        image |= 1 << X2_STEP_PIN;
+#endif
+#ifdef Y2_STEP_PIN
+    if(step_outbits_2.y)
+        image |= 1 << Y2_STEP_PIN;
+#endif
+#ifdef Z2_STEP_PIN
+    if(step_outbits_2.z)
+        image |= 1 << Z2_STEP_PIN;
+#endif
+
+    return image;
+}
 
 #elif STEP_PORT == GPIO_SR8
 
-    sd_sr.set.x_step = step_outbits_1.x;
+// Returns the shift register step bits for the primary and ganged motors step signals.
+static uint8_t step_image (axes_signals_t step_outbits_1, axes_signals_t step_outbits_2)
+{
+    step_dir_t image = {0};
+
+    image.x_step = step_outbits_1.x;
 #ifdef X2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits_2.x;
+    image.m3_step = step_outbits_2.x;
 #endif
-    sd_sr.set.y_step = step_outbits_1.y;
+    image.y_step = step_outbits_1.y;
 #ifdef Y2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits_2.y;
+    image.m3_step = step_outbits_2.y;
 #endif
-    sd_sr.set.z_step = step_outbits_1.z;
+    image.z_step = step_outbits_1.z;
 #ifdef Z2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits_2.z;
+    image.m3_step = step_outbits_2.z;
 #endif
 #ifdef A_STEP_PIN
-    sd_sr.set.m3_step = step_outbits_1.a;
+    image.m3_step = step_outbits_1.a;
+#endif
+
+    return image.value;
+}
+
+#elif STEP_PORT == GPIO_PIO_1
+
+// Returns the step_pulse_map program pin image of a step group for the primary and ganged motors step signals.
+static uint16_t step_image (step_sm_t *step, axes_signals_t step_outbits_1, axes_signals_t step_outbits_2)
+{
+    uint_fast8_t i;
+    uint16_t image = 0;
+
+    for(i = 0; i < sizeof(step_pin); i++) {
+        if((step_outbits_1.mask & (1 << i)) && step_pin[i] != 0xFF && (step->pins & (1 << step_pin[i])))
+            image |= 1 << (step_pin[i] - step->base);
+    }
+
+    for(i = 0; i < sizeof(step2_pin); i++) {
+        if((step_outbits_2.mask & (1 << i)) && step2_pin[i] != 0xFF && (step->pins & (1 << step2_pin[i])))
+            image |= 1 << (step2_pin[i] - step->base);
+    }
+
+    return image;
+}
+
+#endif
+
+#if DIRECTION_PORT == GPIO_OUTPUT
+
+// Returns the GPIO direction pin image for the primary and ganged motors direction signals.
+static uint32_t dir_image (axes_signals_t dir_outbits, axes_signals_t dir_outbits2)
+{
+    uint32_t image = 0;
+
+    if(dir_outbits.x)
+        image |= X_DIRECTION_BIT;
+    if(dir_outbits.y)
+        image |= Y_DIRECTION_BIT;
+    if(dir_outbits.z)
+        image |= Z_DIRECTION_BIT;
+#ifdef A_DIRECTION_PIN
+    if(dir_outbits.a)
+        image |= A_DIRECTION_BIT;
+#endif
+#ifdef B_DIRECTION_PIN
+    if(dir_outbits.b)
+        image |= B_DIRECTION_BIT;
+#endif
+#ifdef C_DIRECTION_PIN
+    if(dir_outbits.c)
+        image |= C_DIRECTION_BIT;
+#endif
+#ifdef X2_DIRECTION_PIN
+    if(dir_outbits2.x)
+        image |= X2_DIRECTION_BIT;
+#endif
+#ifdef Y2_DIRECTION_PIN
+    if(dir_outbits2.y)
+        image |= Y2_DIRECTION_BIT;
+#endif
+#ifdef Z2_DIRECTION_PIN
+    if(dir_outbits2.z)
+        image |= Z2_DIRECTION_BIT;
+#endif
+
+    return image;
+}
+
+#elif DIRECTION_PORT == GPIO_SR8 && SD_SHIFT_REGISTER == 16
+
+// Returns the shift register direction bits for the primary and ganged motors direction signals.
+static uint16_t dir_image (axes_signals_t dir_outbits, axes_signals_t dir_outbits2)
+{
+    uint16_t image = 0;
+
+    if(dir_outbits.x)
+        image |= 1 << X_DIRECTION_PIN;
+    if(dir_outbits.y)
+        image |= 1 << Y_DIRECTION_PIN;
+    if(dir_outbits.z)
+        image |= 1 << Z_DIRECTION_PIN;
+#ifdef A_DIRECTION_PIN
+    if(dir_outbits.a)
+        image |= 1 << A_DIRECTION_PIN;
+#endif
+#ifdef B_DIRECTION_PIN
+    if(dir_outbits.b)
+        image |= 1 << B_DIRECTION_PIN;
+#endif
+#ifdef C_DIRECTION_PIN
+    if(dir_outbits.c)
+        image |= 1 << C_DIRECTION_PIN;
+#endif
+#ifdef X2_DIRECTION_PIN
+    if(dir_outbits2.x)
+        image |= 1 << X2_DIRECTION_PIN;
+#endif
+#ifdef Y2_DIRECTION_PIN
+    if(dir_outbits2.y)
+        image |= 1 << Y2_DIRECTION_PIN;
+#endif
+#ifdef Z2_DIRECTION_PIN
+    if(dir_outbits2.z)
+        image |= 1 << Z2_DIRECTION_PIN;
+#endif
+
+    return image;
+}
+
+#elif DIRECTION_PORT == GPIO_SR8
+
+// Returns the shift register direction bits for the primary and ganged motors direction signals.
+static uint8_t dir_image (axes_signals_t dir_outbits, axes_signals_t dir_outbits2)
+{
+    step_dir_t image = {0};
+
+    image.x_dir = dir_outbits.x;
+    image.y_dir = dir_outbits.y;
+    image.z_dir = dir_outbits.z;
+#ifdef X2_DIRECTION_PIN
+    image.m3_dir = dir_outbits2.x;
+#endif
+#ifdef Y2_DIRECTION_PIN
+    image.m3_dir = dir_outbits2.y;
+#endif
+#ifdef Z2_DIRECTION_PIN
+    image.m3_dir = dir_outbits2.z;
+#endif
+#ifdef A_DIRECTION_PIN
+    image.m3_dir = dir_outbits.a;
+#endif
+
+    return image.value;
+}
+
+#endif
+
+// Builds the lookup tables from the current invert masks.
+static void build_luts (settings_t *settings)
+{
+    uint_fast8_t idx;
+    axes_signals_t outbits, outbits2;
+
+    for(idx = 0; idx < 64; idx++) {
+
+        outbits.mask = idx ^ settings->steppers.step_invert.mask;
+
+#if STEP_PORT == GPIO_PIO_1
+        for(uint_fast8_t i = 0; i < n_step_sm; i++) {
+            step_sm[i].map[idx] = step_image(&step_sm[i], outbits, (axes_signals_t){0});
+            if(idx < 8)
+                step_sm[i].map2[idx] = step_image(&step_sm[i], (axes_signals_t){0}, outbits);
+        }
+#elif defined(SQUARING_ENABLED)
+        step_lut[idx] = step_image(outbits, (axes_signals_t){0});
+        if(idx < 8)
+            step_lut2[idx] = step_image((axes_signals_t){0}, outbits);
+#else
+        step_lut[idx] = step_image(outbits, outbits);
+#endif
+
+        outbits.mask = idx ^ settings->steppers.dir_invert.mask;
+#ifdef GANGING_ENABLED
+        outbits2.mask = outbits.mask ^ settings->steppers.ganged_dir_invert.mask;
+#else
+        outbits2.mask = outbits.mask;
+#endif
+        dir_lut[idx] = dir_image(outbits, outbits2);
+    }
+
+#if DIRECTION_PORT == GPIO_OUTPUT
+    dir_lut_mask = dir_image((axes_signals_t){AXES_BITMASK}, (axes_signals_t){AXES_BITMASK});
+#endif
+}
+
+#ifdef SQUARING_ENABLED
+
+static axes_signals_t motors_1 = {AXES_BITMASK}, motors_2 = {AXES_BITMASK};
+
+// Set stepper pulse output pins
+// NOTE: step_outbits are: bit0 -> X, bit1 -> Y, bit2 -> Z...
+inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_signals_t step_outbits_1)
+{
+    axes_signals_t step_outbits_2;
+
+    step_outbits_2.mask = step_outbits_1.mask & motors_2.mask;
+    step_outbits_1.mask &= motors_1.mask;
+
+#if STEP_PORT == GPIO_PIO_1
+
+    uint_fast8_t i = 0;
+    uint32_t timing = pio_steps.value & 0xFFFF;
+
+    do {
+        step_pulse_map_generate(step_sm[i].pio, step_sm[i].sm, timing | ((uint32_t)(step_sm[i].map[step_outbits_1.mask & 0x3F] | step_sm[i].map2[step_outbits_2.mask & 0x07]) << 16));
+    } while(++i < n_step_sm);
+
+#elif STEP_PORT == GPIO_PIO && STEP_PULSE_AXIS_ENABLE
+
+    uint_fast8_t i = 0;
+    step_axis_stage_t *stage = step_axis.stage;
+
+    STEP_AXIS_LOCK();
+
+    do {
+        step_pulse_generate(pio0, 0, stage[0].wait | (step_lut[step_outbits_1.mask & stage[0].active] | step_lut2[step_outbits_2.mask & stage[0].active & 0x07]) << 8 |
+                                      (stage[1].wait | (step_lut[step_outbits_1.mask & stage[1].active] | step_lut2[step_outbits_2.mask & stage[1].active & 0x07]) << 8) << 16);
+        stage += 2;
+    } while((i += 2) < step_axis.n_stages);
+
+    STEP_AXIS_UNLOCK();
+
+#elif STEP_PORT == GPIO_PIO
+
+    pio_steps.set = step_lut[step_outbits_1.mask] | step_lut2[step_outbits_2.mask & 0x07];
+
+#if STEP_STREAM_ENABLE
+    stream.step = (uint32_t)pio_steps.set << stream.shift;
+#else
+    step_pulse_generate(pio0, 0, pio_steps.value);
 #endif
+
+#elif STEP_PORT == GPIO_SR8
+
+    sd_sr.set.value = (sd_sr.set.value & SD_SR_DIR_BITS) | step_lut[step_outbits_1.mask] | step_lut2[step_outbits_2.mask & 0x07];
     step_dir_sr4_write(pio0, 0, sd_sr.value);
 
 #endif
@@ -867,280 +1783,1248 @@ static void StepperDisableMotors (axes_signals_t axes, squaring_mode_t mode)
 // NOTE: step_outbits are: bit0 -> X, bit1 -> Y, bit2 -> Z...
 inline static __attribute__((always_inline)) void stepperSetStepOutputs (axes_signals_t step_outbits)
 {
-    step_outbits.mask ^= settings.steppers.step_invert.mask;
-
 #if STEP_PORT == GPIO_PIO_1
 
-    pio_steps.set = step_outbits.x;
-    pio_steps.reset = settings.steppers.step_invert.x;
-    step_pulse_generate(pio1, x_step_sm, pio_steps.value);
-#ifdef X2_STEP_PIN
-    step_pulse_generate(pio0, x2_step_sm, pio_steps.value);
+    uint_fast8_t i = 0;
+    uint32_t timing = pio_steps.value & 0xFFFF;
+
+    do {
+        step_pulse_map_generate(step_sm[i].pio, step_sm[i].sm, timing | ((uint32_t)(step_sm[i].map[step_outbits.mask & 0x3F] | step_sm[i].map2[step_outbits.mask & 0x07]) << 16));
+    } while(++i < n_step_sm);
+
+#elif STEP_PORT == GPIO_PIO && STEP_PULSE_AXIS_ENABLE
+
+    uint_fast8_t i = 0;
+    step_axis_stage_t *stage = step_axis.stage;
+
+    STEP_AXIS_LOCK();
+
+    do {
+        step_pulse_generate(pio0, 0, stage[0].wait | step_lut[step_outbits.mask & stage[0].active] << 8 |
+                                      (stage[1].wait | step_lut[step_outbits.mask & stage[1].active] << 8) << 16);
+        stage += 2;
+    } while((i += 2) < step_axis.n_stages);
+
+    STEP_AXIS_UNLOCK();
+
+#elif STEP_PORT == GPIO_PIO
+
+    pio_steps.set = step_lut[step_outbits.mask];
+
+#if STEP_STREAM_ENABLE
+    stream.step = (uint32_t)pio_steps.set << stream.shift;
+#else
+    step_pulse_generate(pio0, 0, pio_steps.value);
 #endif
-    pio_steps.set = step_outbits.y;
-    pio_steps.reset = settings.steppers.step_invert.y;
-    step_pulse_generate(pio1, y_step_sm, pio_steps.value);
-#ifdef Y2_STEP_PIN
-    step_pulse_generate(pio0, y2_step_sm, pio_steps.value);
+
+#elif STEP_PORT == GPIO_SR8
+
+    sd_sr.set.value = (sd_sr.set.value & SD_SR_DIR_BITS) | step_lut[step_outbits.mask];
+    step_dir_sr4_write(pio0, 0, sd_sr.value);
+
 #endif
-    pio_steps.set = step_outbits.z;
-    pio_steps.reset = settings.steppers.step_invert.z;
-    step_pulse_generate(z_step_pio, z_step_sm, pio_steps.value);
-#ifdef Z2_STEP_PIN
-    step_pulse_generate(pio0, z2_step_sm, pio_steps.value);
+}
+
+#endif // SQUARING_ENABLED
+
+#ifdef GANGING_ENABLED
+
+static axes_signals_t getGangedAxes (bool auto_squared)
+{
+    axes_signals_t ganged = {0};
+
+    if (auto_squared) {
+#if X_AUTO_SQUARE
+        ganged.x = On;
 #endif
-#ifdef A_STEP_PIN
-    pio_steps.set = step_outbits.a;
-    pio_steps.reset = settings.steppers.step_invert.a;
-    step_pulse_generate(pio0, a_step_sm, pio_steps.value);
+#if Y_AUTO_SQUARE
+        ganged.y = On;
 #endif
-#ifdef B_STEP_PIN
-    pio_steps.set = step_outbits.b;
-    pio_steps.reset = settings.steppers.step_invert.b;
-    step_pulse_generate(pio0, b_step_sm, pio_steps.value);
+#if Z_AUTO_SQUARE
+        ganged.z = On;
 #endif
-#ifdef C_STEP_PIN
-    pio_steps.set = step_outbits.c;
-    pio_steps.reset = settings.steppers.step_invert.c;
-    step_pulse_generate(pio0, c_step_sm, pio_steps.value);
+    } else {
+#if X_GANGED
+        ganged.x = On;
 #endif
 
-#elif STEP_PORT == GPIO_PIO
-
-    pio_steps.set = step_outbits.mask & 0x07;
-#ifdef X2_STEP_PIN
-    if (step_outbits.x)
-        pio_steps.set |= (1 << (X2_STEP_PIN - STEP_PINS_BASE));
-#endif
-#ifdef Y2_STEP_PIN
-    if (step_outbits.y)
-        pio_steps.set |= (1 << (Y2_STEP_PIN - STEP_PINS_BASE));
+#if Y_GANGED
+        ganged.y = On;
 #endif
-#ifdef Z2_STEP_PIN
-    if (step_outbits.z)
-        pio_steps.set |= (1 << (Z2_STEP_PIN - STEP_PINS_BASE));
+
+#if Z_GANGED
+        ganged.z = On;
 #endif
-#ifdef A_STEP_PIN
-    if (step_outbits.a)
-        pio_steps.set |= (1 << (A_STEP_PIN - STEP_PINS_BASE));
+    }
+
+    return ganged;
+}
+
 #endif
-#ifdef B_STEP_PIN
-    if (step_outbits.b)
-        pio_steps.set |= (1 << (B_STEP_PIN - STEP_PINS_BASE));
+
+// Set stepper direction output pins
+// NOTE: see note for stepperSetStepOutputs()
+//inline static __attribute__((always_inline)) void stepperSetDirOutputs (axes_signals_t dir_outbits)
+static void __not_in_flash_func(stepperSetDirOutputs)(axes_signals_t dir_outbits)
+{
+#if STEP_INJECT_ENABLE
+    step_inject.dir_out = dir_outbits;
 #endif
-#ifdef C_STEP_PIN
-    if (step_outbits.c)
-        pio_steps.set |= (1 << (C_STEP_PIN - STEP_PINS_BASE));
+#if DIRECTION_PORT == GPIO_OUTPUT
+    gpio_put_masked(dir_lut_mask, dir_lut[dir_outbits.mask]);
+#elif DIRECTION_PORT == GPIO_SR8
+    sd_sr.set.value = (sd_sr.set.value & SD_SR_STEP_BITS) | dir_lut[dir_outbits.mask];
+    sd_sr.reset.value = (sd_sr.reset.value & SD_SR_STEP_BITS) | dir_lut[dir_outbits.mask];
+    // dir signals are set on the next step pulse output
 #endif
+}
 
-    step_pulse_generate(pio0, 0, pio_steps.value);
+// Sets stepper direction and pulse pins and starts a step pulse.
+#if STEP_INJECT_ENABLE
 
-#elif STEP_PORT == GPIO_SR8
+// Updates the machine position for an injected step as it is output, called on the stepper core.
+static inline void __not_in_flash_func(stepperInjectPosition)(step_inject_t *entry)
+{
+    uint_fast8_t idx = 0;
+    axes_signals_t step = entry->step;
+
+    do {
+        if(step.mask & 0x01)
+            sys.position[idx] += entry->dir.mask & bit(idx) ? -1 : 1;
+        idx++;
+    } while(step.mask >>= 1);
+}
+
+// Adds the queued step at the tail to the step signals of a tick if it can be output, main_axes are the axes moved
+// or stepped by the main motion. Returns the direction signals to output for the tick.
+// Direction signals of the main motion axes are set by the core, in the tick of their step. A queued step needing
+// a direction change is delayed to the next tick and the main direction is restored in a tick without a step on the
+// axis, so the direction setup time of injected steps is at least a tick regardless of the step pulse delay.
+// A queued step is held back while the main motion steps any of its axes or moves any of them in the other direction.
+static axes_signals_t __not_in_flash_func(stepperInjectNext)(axes_signals_t main_axes, axes_signals_t *step_outbits)
+{
+    uint_fast8_t tail = step_inject.tail;
+    axes_signals_t dir_outbits = step_inject.dir_out, used = {0};
+
+    dir_outbits.mask = (dir_outbits.mask & ~main_axes.mask) | (step_inject.dir.mask & main_axes.mask);
+
+    if(tail != step_inject.head) {
+
+        step_inject_t *entry = &step_inject.queue[tail];
+
+        __dmb(); // Read the entry after the head index
+        used = entry->step;
+
+        if(!(used.mask & step_outbits->mask) && !((entry->dir.mask ^ dir_outbits.mask) & used.mask & main_axes.mask)) {
+            if((entry->dir.mask ^ step_inject.dir_out.mask) & used.mask)
+                dir_outbits.mask = (dir_outbits.mask & ~used.mask) | (entry->dir.mask & used.mask);
+            else {
+                step_outbits->mask |= used.mask;
+                if(entry->position)
+                    stepperInjectPosition(entry);
+                __dmb();
+                step_inject.tail = (tail + 1) & (STEP_INJECT_QUEUE_SIZE - 1);
+            }
+        }
+    }
+
+    used.mask |= main_axes.mask;
+    dir_outbits.mask = (dir_outbits.mask & used.mask) | (step_inject.dir.mask & ~used.mask);
+
+    return dir_outbits;
+}
+
+// Injected steps are merged with the main motion steps, one queue entry per tick, see stepperInjectNext().
+static void __not_in_flash_func(stepperPulseStart)(stepper_t *stepper)
+{
+    axes_signals_t step_outbits = stepper->step_outbits, dir_outbits;
+
+    if(stepper->dir_change)
+        step_inject.dir = stepper->dir_outbits;
+
+    if(stepper->new_block && stepper->exec_block) {
+        uint_fast8_t idx = N_AXIS;
+        step_inject.moving.mask = 0;
+        do {
+            if(stepper->exec_block->steps[--idx])
+                step_inject.moving.mask |= bit(idx);
+        } while(idx);
+    }
+
+    dir_outbits = stepperInjectNext((axes_signals_t){step_inject.moving.mask | step_outbits.mask}, &step_outbits);
+
+    if(dir_outbits.mask != step_inject.dir_out.mask)
+        stepperSetDirOutputs(dir_outbits);
+
+    if(step_outbits.value)
+        stepperSetStepOutputs(step_outbits);
+}
+
+#else
+
+static void __not_in_flash_func(stepperPulseStart)(stepper_t *stepper)
+{
+    if (stepper->dir_change)
+        stepperSetDirOutputs(stepper->dir_outbits);
+
+    if (stepper->step_outbits.value)
+        stepperSetStepOutputs(stepper->step_outbits);
+}
 
-    sd_sr.set.x_step = step_outbits.x;
-#ifdef X2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits.x;
-#endif
-    sd_sr.set.y_step = step_outbits.y;
-#ifdef Y2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits.y;
 #endif
-    sd_sr.set.z_step = step_outbits.z;
-#ifdef Z2_STEP_PIN
-    sd_sr.set.m3_step = step_outbits.z;
+
+#if STEP_STREAM_ENABLE
+
+// Returns the direction pin image as written by stepperSetDirOutputs(), relative to the step stream base pin.
+static uint32_t __not_in_flash_func(stepStreamDirImage)(axes_signals_t dir_outbits)
+{
+    return dir_lut[dir_outbits.mask] >> stream.base;
+}
+
+// Appends a tick to a block, periods too long for the 16 bit remaining period field are split into idle ticks.
+static uint32_t *__not_in_flash_func(stepStreamTick)(uint32_t *word, uint32_t step, uint32_t period)
+{
+    uint32_t delay = pio_steps.delay, length = pio_steps.length, remaining;
+
+    do {
+        period = period > delay + length + STEP_STREAM_TICK_CYCLES ? period - (delay + length + STEP_STREAM_TICK_CYCLES) : 0;
+        remaining = period > 0xFFFF ? 0xFFFF : period;
+        *word++ = stream.dir | stream.step_idle;
+        *word++ = stream.dir | step;
+        *word++ = delay | (length << 8) | (remaining << 16);
+        period -= remaining;
+        step = stream.step_idle;
+        delay = length = 0;
+    } while(period);
+
+    return word;
+}
+
+#if SYNC_OUTPUT_ENABLE
+
+// Output changes made by the core while a block is filled, synchronized outputs (M62, M63) executed by the core stepper
+// interrupt handler at the start of a motion block, are queued and the tick being generated is marked. The step_stream
+// program raises PIO IRQ flag 2 when it starts output of a marked tick and the changes for the tick are applied by
+// sync_output_irq(). Marked ticks are spaced at least 5 microseconds apart so a flag is not raised again before it
+// is serviced, changes for a tick closer to the previous marked tick are moved to the first tick after the spacing.
+// sync_output_irq() runs at the highest priority so it is not held off by the block fill for longer than the spacing.
+// Changes made outside of the block fill, including from the other core or from other interrupts while filling, are
+// output immediately. If the queue is full the change is output immediately and counted as an overrun.
+static void __not_in_flash_func(syncDigitalOut)(uint8_t port, bool on)
+{
+    if(stream.filling && get_core_num() == STEPPER_CORE && __get_current_exception() == VTABLE_FIRST_IRQ + DMA_IRQ_1) {
+
+        uint_fast8_t head = sync_out.head, next = (head + 1) & (SYNC_OUTPUT_QUEUE_SIZE - 1);
+
+        if(next != sync_out.tail) {
+            sync_out.queue[head].port = port;
+            sync_out.queue[head].on = on;
+            sync_out.queue[head].last = false;
+            __dmb(); // Write the entry before the head index
+            sync_out.head = next;
+            sync_out.pending = true;
+            return;
+        }
+
+        sync_out.overruns++;
+    }
+
+    sync_out.digital_out(port, on);
+}
+
+// Marks the tick starting at word, as written by stepStreamTick(), if changes are pending and the spacing to the previous marked tick allows.
+static void __not_in_flash_func(syncOutputMark)(uint32_t *word, uint32_t period)
+{
+    if(sync_out.pending && sync_out.spacing >= hal.f_step_timer / 200000) {
+        *word |= STEP_STREAM_SYNC;
+        sync_out.queue[(sync_out.head - 1) & (SYNC_OUTPUT_QUEUE_SIZE - 1)].last = true;
+        sync_out.pending = false;
+        sync_out.spacing = 0;
+    }
+
+    if(sync_out.spacing < hal.f_step_timer)
+        sync_out.spacing += period;
+}
+
+// A marked tick is being output, applies the changes queued for it.
+static void __not_in_flash_func(sync_output_irq)(void)
+{
+    bool last = false;
+    uint_fast8_t tail = sync_out.tail;
+
+    pio_interrupt_clear(pio0, 2);
+
+    while(!last && tail != sync_out.head) {
+        sync_out.digital_out(sync_out.queue[tail].port, sync_out.queue[tail].on);
+        last = sync_out.queue[tail].last;
+        tail = (tail + 1) & (SYNC_OUTPUT_QUEUE_SIZE - 1);
+    }
+
+    sync_out.tail = tail;
+}
+
+// Last block transferred, applies changes left, e.g. for ticks not marked due to the spacing.
+static void __not_in_flash_func(syncOutputDrain)(void)
+{
+    sync_out.pending = false;
+
+    while(sync_out.tail != sync_out.head) {
+        sync_out.digital_out(sync_out.queue[sync_out.tail].port, sync_out.queue[sync_out.tail].on);
+        sync_out.tail = (sync_out.tail + 1) & (SYNC_OUTPUT_QUEUE_SIZE - 1);
+    }
+}
+
+// Motion aborted, the changes queued are for ticks that will not be output.
+static void __not_in_flash_func(syncOutputFlush)(void)
+{
+    sync_out.tail = sync_out.head;
+    sync_out.pending = false;
+    pio_interrupt_clear(pio0, 2);
+}
+
+// $SYNCOUT - reports the number of queued output changes and the number of changes output immediately as the queue was full.
+static status_code_t sync_output_report (sys_state_t state)
+{
+    UNUSED(state);
+
+    hal.stream.write("[SYNCOUT:");
+    hal.stream.write(uitoa((sync_out.head - sync_out.tail) & (SYNC_OUTPUT_QUEUE_SIZE - 1)));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(sync_out.overruns));
+    hal.stream.write("]" ASCII_EOL);
+
+    return Status_OK;
+}
+
+#endif // SYNC_OUTPUT_ENABLE
+
+// Runs the core stepper interrupt handler once per tick until the block is full, holds STEP_STREAM_BLOCK_TIME of ticks
+// or motion ends. The time limit bounds how far the core runs ahead of the output at low step rates, and by that the
+// reaction time to feed hold and jog cancel, to two blocks or two ticks if the ticks are longer.
+static uint32_t __not_in_flash_func(stepStreamFill)(uint32_t *block)
+{
+    uint32_t *word = block, *end = block + STEP_STREAM_BLOCK_WORDS - STEP_STREAM_TICK_MAX;
+    uint32_t time = 0, max_time = hal.f_step_timer / 1000000 * STEP_STREAM_BLOCK_TIME;
+
+    stream.filling = true;
+
+    while(stream.running && word <= end && time < max_time) {
+        stream.step = stream.step_idle;
+        hal.stepper.interrupt_callback();
+#if SYNC_OUTPUT_ENABLE
+        uint32_t *tick = word;
+        word = stepStreamTick(word, stream.step, stream.period);
+        syncOutputMark(tick, stream.period);
+#else
+        word = stepStreamTick(word, stream.step, stream.period);
+#endif
+        time += stream.period;
+    }
+
+    stream.filling = false;
+
+    return word - block;
+}
+
+// Outputs idle step signals and the current direction signals when no block is being transferred.
+static void stepStreamOutputIdle (void)
+{
+    if(!stream.busy) {
+        pio_sm_put(pio0, stream.sm, stream.dir | stream.step_idle);
+        pio_sm_put(pio0, stream.sm, stream.dir | stream.step_idle);
+        pio_sm_put(pio0, stream.sm, 0);
+    }
+}
+
+// Starts streaming with a ~2ms idle tick to allow drivers time to wake up.
+static void stepStreamWakeUp (void)
+{
+    stepperEnable((axes_signals_t){AXES_BITMASK});
+
+    stream.period = hal.f_step_timer / 500;
+
+    ATOMIC_ENTER();
+    stream.running = true;
+    if(!stream.busy) {
+        stream.busy = true;
+        stream.active = 0;
+        stream.words[1] = 0;
+        stream.words[0] = stepStreamTick(stream.block[0], stream.step_idle, stream.period) - stream.block[0];
+        dma_channel_transfer_from_buffer_now(stream.dma_channel, stream.block[0], stream.words[0]);
+    }
+    ATOMIC_EXIT();
+}
+
+// Stops filling blocks, ticks already queued are output unless clear_signals is set.
+static void __not_in_flash_func(stepStreamGoIdle)(bool clear_signals)
+{
+    stream.running = false;
+
+    if(clear_signals) {
+        dma_channel_set_irq1_enabled(stream.dma_channel, false);
+        dma_channel_abort(stream.dma_channel);
+        dma_channel_acknowledge_irq1(stream.dma_channel);
+        dma_channel_set_irq1_enabled(stream.dma_channel, true);
+        pio_sm_clear_fifos(pio0, stream.sm);
+        pio_sm_restart(pio0, stream.sm);
+        pio_sm_exec(pio0, stream.sm, pio_encode_jmp(stream.offset));
+        stream.words[0] = stream.words[1] = 0;
+        stream.busy = false;
+#if SYNC_OUTPUT_ENABLE
+        syncOutputFlush();
+#endif
+        stepStreamOutputIdle();
+    }
+}
+
+static void __not_in_flash_func(stepStreamCyclesPerTick)(uint32_t cycles_per_tick)
+{
+    stream.period = cycles_per_tick < 1000000 ? cycles_per_tick : 1000000;
+}
+
+// Records direction and step signals for the tick being generated.
+static void __not_in_flash_func(stepStreamPulseStart)(stepper_t *stepper)
+{
+    if(stepper->dir_change)
+        stream.dir = stepStreamDirImage(stepper->dir_outbits);
+
+    if(stepper->step_outbits.value)
+        stepperSetStepOutputs(stepper->step_outbits);
+}
+
+// DMA block completed, start transfer of the next block and refill the completed one.
+static void __not_in_flash_func(step_stream_dma_handler)(void)
+{
+    uint_fast8_t next = stream.active ^ 1;
+
+    dma_channel_acknowledge_irq1(stream.dma_channel);
+
+    if(stream.words[next] == 0 && stream.running) // Next block not prefilled, e.g. after wake up.
+        stream.words[next] = stepStreamFill(stream.block[next]);
+
+    ATOMIC_ENTER();
+    if((stream.busy = stream.words[next] != 0)) {
+        dma_channel_transfer_from_buffer_now(stream.dma_channel, stream.block[next], stream.words[next]);
+        stream.words[stream.active] = 0;
+        stream.active = next;
+    }
+    ATOMIC_EXIT();
+
+    if(stream.busy)
+        stream.words[next ^ 1] = stepStreamFill(stream.block[next ^ 1]);
+#if SYNC_OUTPUT_ENABLE
+    else
+        syncOutputDrain();
 #endif
+}
+
+// Claims the DMA channel and connects the step and direction pins to the step_stream PIO program.
+static void stepStreamInit (void)
+{
+    uint32_t i, pin_mask = 0;
+
+    for(i = 0; i < sizeof(outputpin) / sizeof(output_signal_t); i++) {
+        if(outputpin[i].group == PinGroup_StepperStep || outputpin[i].group == PinGroup_StepperDir)
+            pin_mask |= 1 << outputpin[i].pin;
+    }
+
+    stream.base = __builtin_ctz(pin_mask);
+    stream.shift = STEP_PINS_BASE - stream.base;
+
+    stream.sm = 0; // Claimed by driver_init()
+    step_stream_program_init(pio0, stream.sm, stream.offset, stream.base, 32 - __builtin_clz(pin_mask) - stream.base, pin_mask, pio_clkdiv(STEP_TIMER_CLOCK));
+
+    stream.dma_channel = dma_claim_unused_channel(true);
+
+    dma_channel_config config = dma_channel_get_default_config(stream.dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio0, stream.sm, true));
+    dma_channel_configure(stream.dma_channel, &config, &pio0->txf[stream.sm], NULL, 0, false);
+    dma_channel_set_irq1_enabled(stream.dma_channel, true);
+
+#if SYNC_OUTPUT_ENABLE
+    if(hal.port.digital_out) {
+        sync_out.digital_out = hal.port.digital_out;
+        hal.port.digital_out = syncDigitalOut;
+    }
+    sync_out.spacing = hal.f_step_timer;
+    pio_interrupt_clear(pio0, 2);
+    pio_set_irq0_source_enabled(pio0, pis_interrupt2, true);
+#endif
+
+#if !STEPPER_CORE1_ENABLE
+    irq_set_exclusive_handler(DMA_IRQ_1, step_stream_dma_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+  #if SYNC_OUTPUT_ENABLE
+    irq_set_exclusive_handler(PIO0_IRQ_0, sync_output_irq);
+    irq_set_priority(PIO0_IRQ_0, PICO_HIGHEST_IRQ_PRIORITY); // Preempts the block fill
+    irq_set_enabled(PIO0_IRQ_0, true);
+  #endif
+#endif
+}
+
+#endif // STEP_STREAM_ENABLE
+
+#if STEP_SELFTEST_ENABLE || PROBE_LATCH_ENABLE || LASER_VELOCITY_ENABLE
+
+// Primary motor step and direction pins per axis, for PIO state machines sampling the outputs.
+
+static const uint8_t axis_step_pin[] = {
+    X_STEP_PIN, Y_STEP_PIN, Z_STEP_PIN,
 #ifdef A_STEP_PIN
-    sd_sr.set.m3_step = step_outbits.a;
+    A_STEP_PIN,
 #endif
-    step_dir_sr4_write(pio0, 0, sd_sr.value);
+#ifdef B_STEP_PIN
+    B_STEP_PIN,
+#endif
+#ifdef C_STEP_PIN
+    C_STEP_PIN,
+#endif
+};
+
+static const uint8_t axis_dir_pin[] = {
+    X_DIRECTION_PIN, Y_DIRECTION_PIN, Z_DIRECTION_PIN,
+#ifdef A_DIRECTION_PIN
+    A_DIRECTION_PIN,
+#endif
+#ifdef B_DIRECTION_PIN
+    B_DIRECTION_PIN,
+#endif
+#ifdef C_DIRECTION_PIN
+    C_DIRECTION_PIN,
+#endif
+};
+
+#endif
+
+#if STEP_SELFTEST_ENABLE
+
+#if STEP_PORT == GPIO_SR8 || DIRECTION_PORT != GPIO_OUTPUT || STEP_STREAM_ENABLE
+#error "Step output self-test requires PIO step outputs and GPIO direction outputs!"
+#endif
+
+// Step output self-test, a spare PIO state machine samples the step and direction pins while
+// the driver outputs step pulses. Each pulse is followed by one in the opposite direction so
+// the motors do not move.
+
+#define SELFTEST_TIMEOUT_US 10000
+
+typedef struct {
+    int32_t width;  // step pulse width in cycles, -1 on timeout
+    int32_t setup;  // direction to step setup time in cycles, -1 on timeout
+    int32_t skew;   // step edge relative to the X step edge in cycles
+} selftest_result_t;
+
+// Arms the probe state machine, outputs a step pulse and returns the measured time in cycles or -1 on timeout.
+static int32_t selftest_measure (PIO pio, uint sm, uint offset, uint entry, uint jmp_pin, uint in_pin, axes_signals_t step, axes_signals_t dir)
+{
+    int32_t cycles = -1;
+    absolute_time_t timeout = make_timeout_time_us(SELFTEST_TIMEOUT_US);
+
+    step_probe_program_init(pio, sm, offset, entry, jmp_pin, in_pin);
+
+    stepperSetDirOutputs(dir);
+    stepperSetStepOutputs(step);
+
+    while(pio_sm_is_rx_fifo_empty(pio, sm) && !time_reached(timeout));
+
+    if(!pio_sm_is_rx_fifo_empty(pio, sm))
+        cycles = (int32_t)(pio_sm_get(pio, sm) << 2);
+
+    pio_sm_set_enabled(pio, sm, false);
+    busy_wait_us(100); // Wait for the pulse to complete
+
+    return cycles;
+}
+
+static bool selftest_run (selftest_result_t *result)
+{
+    PIO pio = pio0;
+    int32_t sm, before, after;
+    uint offset, idx;
+
+    if(!pio_can_add_program(pio, &step_probe_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+        pio = pio1;
+        if(!pio_can_add_program(pio, &step_probe_program) || (sm = pio_claim_unused_sm(pio, false)) == -1)
+            return false;
+    }
+
+    offset = pio_add_program(pio, &step_probe_program);
+
+    // Invert the inputs of inverted signals so the probe sees active high signals.
+    for(idx = 0; idx < sizeof(axis_step_pin); idx++) {
+        gpio_set_inover(axis_step_pin[idx], bit_istrue(settings.steppers.step_invert.mask, bit(idx)) ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+        gpio_set_inover(axis_dir_pin[idx], bit_istrue(settings.steppers.dir_invert.mask, bit(idx)) ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+    }
+
+    for(idx = 0; idx < sizeof(axis_step_pin); idx++) {
+
+        axes_signals_t axis = { .mask = bit(idx) }, axes = { .mask = bit(idx) | X_AXIS_BIT };
+
+        stepperSetDirOutputs((axes_signals_t){0});
+        busy_wait_us(100);
+
+        result[idx].setup = selftest_measure(pio, sm, offset, step_probe_offset_edge, axis_dir_pin[idx], axis_step_pin[idx], axis, axis);
+        result[idx].width = selftest_measure(pio, sm, offset, step_probe_offset_pulse, axis_step_pin[idx], axis_step_pin[idx], axis, (axes_signals_t){0});
+        result[idx].skew = 0;
+
+        if(idx) {
+            before = selftest_measure(pio, sm, offset, step_probe_offset_edge, axis_step_pin[0], axis_step_pin[idx], axes, axes);
+            after = selftest_measure(pio, sm, offset, step_probe_offset_edge, axis_step_pin[idx], axis_step_pin[0], axes, (axes_signals_t){0});
+            result[idx].skew = before > 0 ? before : (after > 0 ? -after : 0);
+        }
+    }
+
+    for(idx = 0; idx < sizeof(axis_step_pin); idx++) {
+        gpio_set_inover(axis_step_pin[idx], GPIO_OVERRIDE_NORMAL);
+        gpio_set_inover(axis_dir_pin[idx], GPIO_OVERRIDE_NORMAL);
+    }
+
+    pio_remove_program(pio, &step_probe_program, offset);
+    pio_sm_unclaim(pio, sm);
+
+    return true;
+}
+
+static char *selftest_us (int32_t cycles)
+{
+    return ftoa((float)cycles / (float)(clock_get_hz(clk_sys) / 1000000UL), 3);
+}
+
+// $STEPTEST - measures and reports step pulse width, direction to step setup time and step skew relative to X in microseconds.
+// $STEPTEST=C - also corrects the PIO counts so the measured pulse width and delay match the settings.
+static status_code_t selftest_command (sys_state_t state, char *line)
+{
+    bool calibrate;
+    uint_fast8_t idx, n_ok = 0;
+    int32_t width = 0, setup = 0;
+    selftest_result_t result[sizeof(axis_step_pin)];
+
+    if(!((calibrate = !strcmp(line, "$STEPTEST=C")) || !strcmp(line, "$STEPTEST")))
+        return Status_Unhandled;
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    if(!selftest_run(result))
+        return Status_SelfTestFailed; // No PIO state machine available
+
+    for(idx = 0; idx < sizeof(axis_step_pin); idx++) {
+        char letter[2] = { "XYZABC"[idx], '\0' };
+        hal.stream.write("[STEPTEST:");
+        hal.stream.write(letter);
+        if(result[idx].width < 0 || result[idx].setup < 0)
+            hal.stream.write(",FAILED");
+        else {
+            n_ok++;
+            width += result[idx].width;
+            setup += result[idx].setup;
+            hal.stream.write(",");
+            hal.stream.write(selftest_us(result[idx].width));
+            hal.stream.write(",");
+            hal.stream.write(selftest_us(result[idx].setup));
+            hal.stream.write(",");
+            hal.stream.write(selftest_us(result[idx].skew));
+        }
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    if(calibrate && n_ok) {
+
+        float cycles_per_count = (float)clock_get_hz(clk_sys) / (float)hal.f_step_timer;
+
+        pulse_length_adj += (int16_t)lroundf((settings.steppers.pulse_microseconds * (float)hal.f_step_timer / 1000000.0f) - (float)(width / n_ok) / cycles_per_count);
+        if(settings.steppers.pulse_delay_microseconds > 0.0f)
+            pulse_delay_adj += (int16_t)lroundf((settings.steppers.pulse_delay_microseconds * (float)hal.f_step_timer / 1000000.0f) - (float)(setup / n_ok) / cycles_per_count);
+
+        hal.settings_changed(&settings, (settings_changed_flags_t){0});
+
+        hal.stream.write("[STEPTEST:ADJUST,");
+        hal.stream.write(ftoa((float)pulse_length_adj, 0));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)pulse_delay_adj, 0));
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return n_ok == sizeof(axis_step_pin) ? Status_OK : Status_SelfTestFailed;
+}
+
+#endif // STEP_SELFTEST_ENABLE
+
+// Reports a PIO state machine clock with the divider as set by the SDK, truncated to 8 fractional bits,
+// the error of the resulting clock in ppm and if the divider is in range and the clock within 1000 ppm.
+static bool clock_report_pio (const char *name, uint32_t hz, bool max)
+{
+    float div = pio_clkdiv(hz), err;
+    bool ok;
+
+    if(max && div < 1.0f)
+        div = 1.0f;
+
+    uint32_t div_int = (uint32_t)div, div_frac = (uint32_t)((div - (float)div_int) * 256.0f);
+
+    err = ((float)clock_get_hz(clk_sys) * 256.0f / (float)(div_int * 256 + div_frac) / (float)hz - 1.0f) * 1e6f;
+    ok = div_int >= 1 && div_int <= 0xFFFF && (max ? err <= 1000.0f : fabsf(err) <= 1000.0f);
+
+    hal.stream.write("[CLOCK:");
+    hal.stream.write(name);
+    hal.stream.write(",");
+    hal.stream.write(uitoa(hz));
+    hal.stream.write(",");
+    hal.stream.write(ftoa((float)div_int + (float)div_frac / 256.0f, 4));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(err, 1));
+    hal.stream.write(ok ? ",OK" : ",FAIL");
+    hal.stream.write("]" ASCII_EOL);
+
+    return ok;
+}
+
+// $CLOCKS - reports the system and peripheral clocks and checks the PIO clocks derived from the system clock.
+static status_code_t clock_report (sys_state_t state)
+{
+    bool ok;
+
+    UNUSED(state);
+
+    hal.stream.write("[CLOCK:SYS,");
+    hal.stream.write(uitoa(clock_get_hz(clk_sys)));
+    hal.stream.write("]" ASCII_EOL);
+    hal.stream.write("[CLOCK:PERI,");
+    hal.stream.write(uitoa(clock_get_hz(clk_peri)));
+    hal.stream.write("]" ASCII_EOL);
+
+    ok = clock_report_pio("STEPTIMER", STEP_TIMER_CLOCK, false);
+#if STEP_PORT == GPIO_SR8
+    ok = clock_report_pio("SRDELAY", SR_DELAY_CLOCK, false) && ok;
+#endif
+#if STEP_PORT == GPIO_SR8 || OUT_SHIFT_REGISTER
+    ok = clock_report_pio("SRSHIFT", SR_SHIFT_CLOCK, true) && ok;
+#endif
+#if PPI_ENABLE
+    ok = clock_report_pio("PPI", PPI_PIO_CLOCK, false) && ok;
+#endif
+
+    return ok ? Status_OK : Status_SelfTestFailed;
+}
+
+#if DRIVER_SPINDLE_PWM_ENABLE
+
+// $PWM - reports the spindle PWM frequency achieved and the resolution in bits.
+static status_code_t pwm_report (sys_state_t state)
+{
+    UNUSED(state);
+
+    hal.stream.write("[PWM:SPINDLE,");
+    hal.stream.write(ftoa(spindle_pwm_div.freq, 2));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(spindle_pwm_div.bits));
+    hal.stream.write("]" ASCII_EOL);
+
+    return Status_OK;
+}
+
+#endif
+
+#if STEP_LUT_BENCHMARK_ENABLE
+
+#define STEP_LUT_BENCHMARK_PASSES 1000 // over all 64 axis masks
+
+#if STEP_PORT == GPIO_PIO_1
+#define STEP_LUT_MODE "PIO_1"
+#elif STEP_PORT == GPIO_PIO
+#define STEP_LUT_MODE "PIO"
+#elif SD_SHIFT_REGISTER == 16
+#define STEP_LUT_MODE "SR16"
+#else
+#define STEP_LUT_MODE "SR8"
+#endif
+
+// Step output images from the lookup tables, as stepperSetStepOutputs() loads them with both motors of ganged axes enabled.
+static uint32_t __not_in_flash_func(step_lut_benchmark_step)(uint32_t *checksum)
+{
+    uint_fast8_t mask;
+    uint32_t passes = STEP_LUT_BENCHMARK_PASSES, sum = 0, t = time_us_32();
+
+    do {
+        mask = 64;
+        do {
+            mask--;
+#if STEP_PORT == GPIO_PIO_1
+            uint_fast8_t i = 0;
+            do {
+                sum = sum * 31 + (step_sm[i].map[mask] | step_sm[i].map2[mask & 0x07]);
+            } while(++i < n_step_sm);
+#elif defined(SQUARING_ENABLED)
+            sum = sum * 31 + (step_lut[mask] | step_lut2[mask & 0x07]);
+#else
+            sum = sum * 31 + step_lut[mask];
+#endif
+        } while(mask);
+    } while(--passes);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+// Step output images built bit by bit from the invert mask, as stepperSetStepOutputs() did before the lookup tables.
+static uint32_t __not_in_flash_func(step_lut_benchmark_step_bitwise)(uint32_t *checksum)
+{
+    uint_fast8_t mask;
+    uint32_t passes = STEP_LUT_BENCHMARK_PASSES, sum = 0, t = time_us_32();
+    axes_signals_t outbits;
+
+    do {
+        mask = 64;
+        do {
+            outbits.mask = --mask ^ settings.steppers.step_invert.mask;
+#if STEP_PORT == GPIO_PIO_1
+            uint_fast8_t i = 0;
+            do {
+                sum = sum * 31 + step_image(&step_sm[i], outbits, outbits);
+            } while(++i < n_step_sm);
+#else
+            sum = sum * 31 + step_image(outbits, outbits);
+#endif
+        } while(mask);
+    } while(--passes);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+// Direction output images from the lookup table, as stepperSetDirOutputs() loads them.
+static uint32_t __not_in_flash_func(step_lut_benchmark_dir)(uint32_t *checksum)
+{
+    uint_fast8_t mask;
+    uint32_t passes = STEP_LUT_BENCHMARK_PASSES, sum = 0, t = time_us_32();
+
+    do {
+        mask = 64;
+        do {
+            sum = sum * 31 + dir_lut[--mask];
+        } while(mask);
+    } while(--passes);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+// Direction output images built bit by bit from the invert masks, as stepperSetDirOutputs() did before the lookup table.
+static uint32_t __not_in_flash_func(step_lut_benchmark_dir_bitwise)(uint32_t *checksum)
+{
+    uint_fast8_t mask;
+    uint32_t passes = STEP_LUT_BENCHMARK_PASSES, sum = 0, t = time_us_32();
+    axes_signals_t outbits, outbits2;
+
+    do {
+        mask = 64;
+        do {
+            outbits.mask = --mask ^ settings.steppers.dir_invert.mask;
+#ifdef GANGING_ENABLED
+            outbits2.mask = outbits.mask ^ settings.steppers.ganged_dir_invert.mask;
+#else
+            outbits2.mask = outbits.mask;
+#endif
+            sum = sum * 31 + dir_image(outbits, outbits2);
+        } while(mask);
+    } while(--passes);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+static void step_lut_benchmark_report (const char *name, uint32_t us_lut, uint32_t us_bitwise, bool ok)
+{
+    float cycles = (float)(clock_get_hz(clk_sys) / 1000000UL) / (float)(STEP_LUT_BENCHMARK_PASSES * 64);
+
+    hal.stream.write("[STEPLUT:");
+    hal.stream.write(name);
+    hal.stream.write(",");
+    hal.stream.write(ftoa((float)us_lut * cycles, 1));
+    hal.stream.write(",");
+    hal.stream.write(ftoa((float)us_bitwise * cycles, 1));
+    hal.stream.write(ok ? ",OK" : ",FAIL");
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// $STEPLUT - builds the step and direction output images for all axis masks from the lookup tables and bit by bit from the
+// invert masks, and reports the step output mode and the mean number of system clock cycles per image for each, including
+// loop overhead. Nothing is output, the images are checksummed and FAIL is reported if the two paths disagree.
+static status_code_t step_lut_benchmark (sys_state_t state)
+{
+    bool ok;
+    uint32_t t_lut, t_bitwise, sum_lut, sum_bitwise;
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    hal.stream.write("[STEPLUT:MODE," STEP_LUT_MODE "]" ASCII_EOL);
+
+    t_lut = step_lut_benchmark_step(&sum_lut);
+    t_bitwise = step_lut_benchmark_step_bitwise(&sum_bitwise);
+    step_lut_benchmark_report("STEP", t_lut, t_bitwise, (ok = sum_lut == sum_bitwise));
+
+    t_lut = step_lut_benchmark_dir(&sum_lut);
+    t_bitwise = step_lut_benchmark_dir_bitwise(&sum_bitwise);
+    step_lut_benchmark_report("DIR", t_lut, t_bitwise, sum_lut == sum_bitwise);
+
+    return ok && sum_lut == sum_bitwise ? Status_OK : Status_SelfTestFailed;
+}
+
+#endif // STEP_LUT_BENCHMARK_ENABLE
+
+// Driver system commands, see timing_command(), selftest_command(), stepper_dda_benchmark(), step_lut_benchmark(),
+// out_sr_report(), limit_latch_report(), clock_report(), pwm_report() and pwm_divider_selftest().
+static status_code_t driver_sys_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_Unhandled;
+
+#if STEPPER_TIMING_ENABLE
+    retval = timing_command(state, line);
+#endif
+#if LIMIT_LATCH_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$LIMLATCH"))
+        retval = limit_latch_report(state);
+#endif
+    if(retval == Status_Unhandled && !strcmp(line, "$CLOCKS"))
+        retval = clock_report(state);
+#if DRIVER_SPINDLE_PWM_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$PWM"))
+        retval = pwm_report(state);
+#endif
+#if PWM_SELFTEST_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$PWMTEST"))
+        retval = pwm_divider_selftest(state);
+#endif
+#if STEP_SELFTEST_ENABLE
+    if(retval == Status_Unhandled)
+        retval = selftest_command(state, line);
+#endif
+#if STEPPER_DDA_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$STEPDDA"))
+        retval = stepper_dda_benchmark(state);
+#endif
+#if STEP_LUT_BENCHMARK_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$STEPLUT"))
+        retval = step_lut_benchmark(state);
+#endif
+#if OUT_SHIFT_REGISTER
+    if(retval == Status_Unhandled && !strcmp(line, "$OUTSR"))
+        retval = out_sr_report(state);
+#endif
+#if STEP_GATE_ENABLE
+    if(retval == Status_Unhandled)
+        retval = step_gate_command(state, line);
+#endif
+#if SYNC_OUTPUT_ENABLE
+    if(retval == Status_Unhandled && !strcmp(line, "$SYNCOUT"))
+        retval = sync_output_report(state);
+#endif
+
+    if(retval == Status_Unhandled && on_unknown_sys_command)
+        retval = on_unknown_sys_command(state, line);
+
+    return retval;
+}
+
+#if STEP_INJECT_ENABLE
+
+// Queues a step for output by the stepper interrupt, returns false if the queue is full. Steps are merged with the motion
+// by stepperPulseStart() while running, else the stepper timer is started in drain mode to output them one per tick.
+// Thread context callers wait up to STEP_INJECT_WAIT microseconds for room in a full queue while the stepper timer runs.
+// If position is true the machine position is updated when the step is output, by the stepper interrupt.
+bool __not_in_flash_func(stepper_inject_step)(axes_signals_t step_outbits, axes_signals_t dir_outbits, bool position)
+{
+    bool ok;
+    uint_fast8_t head;
+
+    if(!step_outbits.value)
+        return true;
+
+    if(!__get_current_exception()) {
+        uint32_t start = time_us_32();
+        while(((step_inject.head + 1) & (STEP_INJECT_QUEUE_SIZE - 1)) == step_inject.tail &&
+               (pio1->ctrl & (1u << stepper_timer_sm)) && time_us_32() - start < STEP_INJECT_WAIT);
+    }
+
+    ATOMIC_ENTER();
+
+    head = step_inject.head;
+
+    if((ok = ((head + 1) & (STEP_INJECT_QUEUE_SIZE - 1)) != step_inject.tail)) {
+
+        step_inject.queue[head].step = step_outbits;
+        step_inject.queue[head].dir = dir_outbits;
+        step_inject.queue[head].position = position;
+        __dmb(); // Write the entry before the head index
+        step_inject.head = (head + 1) & (STEP_INJECT_QUEUE_SIZE - 1);
+
+        if(!(pio1->ctrl & (1u << stepper_timer_sm)))
+            stepperInjectDrainStart();
+    }
 
-#endif
+    ATOMIC_EXIT();
+
+    return ok;
 }
 
-#endif // SQUARING_ENABLED
+// Returns true while injected steps are queued for output.
+bool stepper_inject_pending (void)
+{
+    return step_inject.tail != step_inject.head;
+}
 
-#ifdef GANGING_ENABLED
+// Returns the max. rate in steps per second injected steps are output at in drain mode, when there is no motion.
+// A direction change takes an extra tick. While running one step is output per stepper tick at most.
+uint32_t stepper_inject_rate (void)
+{
+    return step_inject.drain_period ? hal.f_step_timer / step_inject.drain_period : 0;
+}
 
-static axes_signals_t getGangedAxes (bool auto_squared)
+// Steps that cannot be queued are dropped and counted as overruns, reported by $STEPTIME when enabled.
+void __not_in_flash_func(stepperOutputStep)(axes_signals_t step_outbits, axes_signals_t dir_outbits)
 {
-    axes_signals_t ganged = {0};
+    if(!stepper_inject_step(step_outbits, dir_outbits, false))
+        step_inject.overruns++;
+}
 
-    if (auto_squared) {
-#if X_AUTO_SQUARE
-        ganged.x = On;
-#endif
-#if Y_AUTO_SQUARE
-        ganged.y = On;
-#endif
-#if Z_AUTO_SQUARE
-        ganged.z = On;
-#endif
+// Outputs a queued step per stepper timer tick when there is no motion, see stepperInjectNext(). Stops the timer
+// when the queue is empty and the main direction signals are restored.
+static void __not_in_flash_func(stepperInjectDrain)(void)
+{
+    axes_signals_t step_outbits = {0}, dir_outbits = stepperInjectNext((axes_signals_t){0}, &step_outbits);
+
+    if(dir_outbits.mask != step_inject.dir_out.mask || step_outbits.value) {
+        if(dir_outbits.mask != step_inject.dir_out.mask)
+            stepperSetDirOutputs(dir_outbits);
+        if(step_outbits.value)
+            stepperSetStepOutputs(step_outbits);
     } else {
-#if X_GANGED
-        ganged.x = On;
-#endif
+        ATOMIC_ENTER();
+        // Recheck, a step may have been queued while entering.
+        if(step_inject.drain && step_inject.tail == step_inject.head) {
+            step_inject.drain = false;
+#if !STEPPER_CORE1_ENABLE
+            irq_set_enabled(PIO1_IRQ_0, false);
+#endif
+            stepper_timer_stop(pio1, stepper_timer_sm);
+        }
+        ATOMIC_EXIT();
+    }
+}
 
-#if Y_GANGED
-        ganged.y = On;
-#endif
+#endif // STEP_INJECT_ENABLE
 
-#if Z_GANGED
-        ganged.z = On;
+#if STEP_GATE_ENABLE
+
+// Hardware step gate. The step pulse programs test the gate input just before a step pulse is output and skip the
+// pulse if active, steps are blocked within one PIO cycle of the gate input asserting regardless of the CPU state.
+// The input pin configuration inverts the gate input as needed so it is active high at the PIO.
+// Suppressed pulses are counted by the state machines, one count per step timer tick with step output.
+// A control input gate, e.g. E-stop, is always armed. A limit input gate is armed while hard limits are enabled outside
+// of homing, steps are blocked while the switch is engaged - disable hard limits or use limits override to move off it.
+static struct {
+    bool limit;             // Gate input is a limit input
+    bool armed;
+    uint32_t suppressed;    // Suppressed step pulses as last read
+#if STEP_PORT == GPIO_PIO
+    uint offset;            // step_pulse program offset
 #endif
-    }
+} step_gate = {0};
 
-    return ganged;
-}
+static on_realtime_report_ptr on_realtime_report;
 
+// Sets the gate input of the step pulse state machines and clears the suppressed pulse counts.
+static void step_gate_init (void)
+{
+#if STEP_PORT == GPIO_PIO_1
+    for(uint_fast8_t i = 0; i < n_step_sm; i++)
+        step_pulse_map_gate_init(step_sm[i].pio, step_sm[i].sm, STEP_GATE_PIN);
+#else
+    step_pulse_gate_init(pio0, 0, STEP_GATE_PIN);
 #endif
+}
 
-// Set stepper direction output pins
-// NOTE: see note for stepperSetStepOutputs()
-//inline static __attribute__((always_inline)) void stepperSetDirOutputs (axes_signals_t dir_outbits)
-static void stepperSetDirOutputs (axes_signals_t dir_outbits)
+static void step_gate_arm (bool on)
 {
-#if DIRECTION_PORT == GPIO_OUTPUT
+    step_gate.armed = on;
 
-#if DIRECTION_OUTMODE == GPIO_MAP
-    gpio_put_masked(DIRECTION_MASK, dir_outmap[dir_outbits.mask]);
-#ifdef X2_DIRECTION_PIN
-    DIGITAL_OUT(X2_DIRECTION_BIT, (dir_outbits.x ^ settings.steppers.dir_invert.x) ^ settings.steppers.ganged_dir_invert.x);
-#endif
-#ifdef Y2_DIRECTION_PIN
-    DIGITAL_OUT(Y2_DIRECTION_BIT, (dir_outbits.y ^ settings.steppers.dir_invert.y) ^ settings.steppers.ganged_dir_invert.y);
-#endif
-#ifdef Z2_DIRECTION_PIN
-    DIGITAL_OUT(Z2_DIRECTION_BIT, (dir_outbits.z ^ settings.steppers.dir_invert.z) ^ settings.steppers.ganged_dir_invert.z);
-#endif
+#if STEP_PORT == GPIO_PIO_1
+    for(uint_fast8_t i = 0; i < n_step_sm; i++)
+        step_pulse_map_set_gate(step_sm[i].pio, step_sm[i].offset, on);
 #else
-    dir_outbits.mask ^= settings.steppers.dir_invert.mask;
-    gpio_put_masked(DIRECTION_MASK, dir_outbits.mask << DIRECTION_OUTMODE);
-#ifdef GANGING_ENABLED
-    dir_outbits.mask ^= settings.steppers.ganged_dir_invert.mask;
-#ifdef X2_DIRECTION_PIN
-    DIGITAL_OUT(X2_DIRECTION_BIT, dir_outbits.x);
-#endif
-#ifdef Y2_DIRECTION_PIN
-    DIGITAL_OUT(Y2_DIRECTION_BIT, dir_outbits.y);
-#endif
-#ifdef Z2_DIRECTION_PIN
-    DIGITAL_OUT(Z2_DIRECTION_BIT, dir_outbits.z);
-#endif
-#endif
+    step_pulse_set_gate(pio0, step_gate.offset, on);
 #endif
+}
 
-#elif DIRECTION_PORT == GPIO_SR8
+// Called from settings_changed() after the input pins are configured.
+static void step_gate_configure (settings_t *settings)
+{
+    bool found = false;
+    uint_fast8_t i = sizeof(inputpin) / sizeof(input_signal_t);
 
-    dir_outbits.mask ^= settings.steppers.dir_invert.mask;
-    sd_sr.set.x_dir = sd_sr.reset.x_dir = dir_outbits.x;
-    sd_sr.set.y_dir = sd_sr.reset.y_dir = dir_outbits.y;
-    sd_sr.set.z_dir = sd_sr.reset.z_dir = dir_outbits.z;
-#ifdef GANGING_ENABLED
-    dir_outbits.mask ^= settings.steppers.ganged_dir_invert.mask;
-#ifdef X2_DIRECTION_PIN
-    sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits.x;
-#endif
-#ifdef Y2_DIRECTION_PIN
-    sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits.y;
-#endif
-#ifdef Z2_DIRECTION_PIN
-    sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits.z;
-#endif
-#endif
-#ifdef A_DIRECTION_PIN
-    sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits.a;
-#endif
-    // dir signals are set on the next step pulse output
-#endif
+    do {
+        if(inputpin[--i].pin == STEP_GATE_PIN && (inputpin[i].group == PinGroup_Control || inputpin[i].group == PinGroup_Limit || inputpin[i].group == PinGroup_LimitMax)) {
+            found = true;
+            step_gate.limit = inputpin[i].group != PinGroup_Control;
+        }
+    } while(i);
+
+    if(!found)
+        protocol_enqueue_foreground_task(report_plain, "Step gate: gate pin is not a control or limit input");
+
+    step_gate_arm(found && (!step_gate.limit || (step_gate.armed && settings->limits.flags.hard_enabled)));
 }
 
-// Sets stepper direction and pulse pins and starts a step pulse.
-static void __not_in_flash_func(stepperPulseStart)(stepper_t *stepper)
+// Returns the number of suppressed step pulses. With step pins grouped over several state machines all count the same
+// ticks, the count is read from the first by reloading its idle image. That is only done when reload is set, for
+// $STEPGATE in idle state, and only if no step word is queued or being output. Else the count last read is returned.
+static uint32_t step_gate_count (bool reload)
 {
-    if (stepper->dir_change)
-        stepperSetDirOutputs(stepper->dir_outbits);
+#if STEP_PORT == GPIO_PIO_1
+    if(reload) {
 
-    if (stepper->step_outbits.value)
-        stepperSetStepOutputs(stepper->step_outbits);
+        step_sm_t *step = &step_sm[0];
+
+        ATOMIC_ENTER();
+
+        if(!(pio1->ctrl & (1u << stepper_timer_sm)) && pio_sm_is_tx_fifo_empty(step->pio, step->sm) && pio_sm_get_pc(step->pio, step->sm) == step->offset)
+            step_gate.suppressed = step_pulse_map_get_gated(step->pio, step->sm, step->idle);
+
+        ATOMIC_EXIT();
+    }
+#else
+    UNUSED(reload);
+
+    step_gate.suppressed = step_pulse_get_gated(pio0, 0);
+#endif
+
+    return step_gate.suppressed;
 }
 
-#if STEP_INJECT_ENABLE
+// Adds the number of suppressed step pulses to the real time report when not zero: |SG:<count>
+static void step_gate_realtime_report (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    if(step_gate_count(false)) {
+        stream_write("|SG:");
+        stream_write(uitoa(step_gate.suppressed));
+    }
+
+    if(on_realtime_report)
+        on_realtime_report(stream_write, report);
+}
 
-void stepperOutputStep (axes_signals_t step_outbits, axes_signals_t dir_outbits)
+// $STEPGATE - reports gate pin, armed and active state and the number of suppressed step pulses.
+// $STEPGATE=R clears the count.
+static status_code_t step_gate_command (sys_state_t state, char *line)
 {
-    if(step_outbits.value) {
+    if(!strcmp(line, "$STEPGATE=R")) {
+        step_gate_init();
+        step_gate.suppressed = 0;
+        return Status_OK;
+    }
 
-        dir_outbits.mask ^= settings.steppers.dir_invert.mask;
-#ifdef GANGING_ENABLED
-        axes_signals_t dir_outbits2;
-        dir_outbits2.mask = dir_outbits.mask ^ settings.steppers.ganged_dir_invert.mask;
-#endif
+    if(strcmp(line, "$STEPGATE"))
+        return Status_Unhandled;
 
-#if DIRECTION_PORT == GPIO_SR8
+    hal.stream.write("[STEPGATE:");
+    hal.stream.write(uitoa(STEP_GATE_PIN));
+    hal.stream.write(step_gate.limit ? ",LIMIT," : ",CONTROL,");
+    hal.stream.write(uitoa(step_gate.armed));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(gpio_get(STEP_GATE_PIN)));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(step_gate_count(state == STATE_IDLE)));
+    hal.stream.write("]" ASCII_EOL);
 
-        if(step_outbits.x) {
-            sd_sr.set.x_dir = sd_sr.reset.x_dir = dir_outbits.x;
-  #ifdef X2_DIRECTION_PIN
-            sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits2.x;
-  #endif
-        }
-        if(step_outbits.y) {
-            sd_sr.set.y_dir = sd_sr.reset.y_dir = dir_outbits.y;
-  #ifdef Y2_DIRECTION_PIN
-            sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits2.y;
-  #endif
-        }
-        if(step_outbits.z) {
-            sd_sr.set.z_dir = sd_sr.reset.z_dir = dir_outbits.z;
-  #ifdef Z2_DIRECTION_PIN
-            sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits2.z;
-  #endif
-        }
-  #ifdef A_DIRECTION_PIN
-        if(step_outbits.a)
-            sd_sr.set.m3_dir = sd_sr.reset.m3_dir = dir_outbits.a;
-  #endif
-    // dir signals are set on the next step pulse output
-#else // DIRECTION_OUTMODE <= GPIO_MAP
-        if(step_outbits.x) {
-            DIGITAL_OUT(X_DIRECTION_BIT, dir_outbits.x);
-  #ifdef X2_DIRECTION_PIN
-            DIGITAL_OUT(X2_DIRECTION_BIT, dir_outbits2.x);
-  #endif
-        }
-        if(step_outbits.y) {
-            DIGITAL_OUT(Y_DIRECTION_BIT, dir_outbits.y);
-  #ifdef Y2_DIRECTION_PIN
-            DIGITAL_OUT(Y2_DIRECTION_BIT, dir_outbits2.y);
-  #endif
-        }
-        if(step_outbits.z) {
-            DIGITAL_OUT(Z_DIRECTION_BIT, dir_outbits.z);
-  #ifdef Z2_DIRECTION_PIN
-            DIGITAL_OUT(Z2_DIRECTION_BIT, dir_outbits2.z);
-  #endif
-        }
-  #ifdef A_AXIS
-        if(step_outbits.a)
-            DIGITAL_OUT(A_DIRECTION_BIT, dir_outbits.a);
-  #endif
-  #ifdef B_AXIS
-        if(step_outbits.b)
-            DIGITAL_OUT(C_DIRECTION_BIT, dir_outbits.b);
-  #endif
-  #ifdef C_AXIS
-        if(step_outbits.c)
-            DIGITAL_OUT(A_DIRECTION_BIT, dir_outbits.c);
-  #endif
+    return Status_OK;
+}
+
+#endif // STEP_GATE_ENABLE
+
+//*************************  LIMIT  *************************//
+
+#if LIMIT_LATCH_ENABLE
+
+#if STEP_STREAM_ENABLE
+#error "Limit switch latch cannot be used with step streaming, the step position is only updated once per block!"
 #endif
+
+#include "grbl/planner.h"
+#include "grbl/gcode.h"
+
+// Limit switch trip latch for homing. The active edge of the homing switches is serviced by gpio_int_handler() during
+// the homing cycle, the step position and time are latched at the edge. The trip is confirmed when the homing cycle
+// polls the switch and finds it still active, the position at that instant is where the axis is stopped.
+// Bounces are ignored until the switch is seen released, a released switch discards an unconfirmed trip.
+// On homing completion the machine position of each homed axis is corrected for the distance travelled from the latched
+// trip position to the stop position of the last approach, this makes the homed position independent of the seek rate
+// and the polling latency of the homing cycle.
+
+typedef struct {
+    volatile bool tripped;  // Active edge seen
+    bool stopped;           // Trip confirmed by the homing cycle
+    bool valid;             // Last approach was latched
+    uint8_t axis;
+    volatile uint32_t trip_time;
+    volatile int32_t trip_position;
+    int32_t overshoot;      // Steps from the latched trip position to the stop position of the last approach
+    uint32_t latency;       // Microseconds from the active edge to trip confirmation
+} limit_latch_t;
+
+static struct {
+    uint32_t armed;         // Bitmask of limit inputs being latched, by index in limit_inputs
+    limit_latch_t pin[N_AXIS * 2];
+} limit_latch = {0};
+
+static on_homing_completed_ptr on_homing_completed;
+
+// Called on the active edge of a homing switch, on the stepper core. The latch is changed under the atomic lock
+// as the homing cycle confirms trips from the foreground process, on the other core when STEPPER_CORE1_ENABLE is set.
+static void __not_in_flash_func(limit_latch_trip)(uint_fast8_t idx)
+{
+    limit_latch_t *latch = &limit_latch.pin[idx];
+
+    ATOMIC_ENTER();
+
+    if(!latch->tripped) {
+        latch->trip_position = sys.position[latch->axis];
+        latch->trip_time = time_us_32();
+        __dmb(); // Write the latched position and time before the trip flag
+        latch->tripped = true;
     }
 
-    stepperSetStepOutputs(step_outbits);
+    ATOMIC_EXIT();
 }
 
-#endif // STEP_INJECT_ENABLE
+// Arms the latch for the limit input if it is a homing switch for the cycle, called from limitsEnable().
+static bool limit_latch_arm (uint_fast8_t idx, limit_signals_t homing_source)
+{
+    input_signal_t *input = &limit_inputs.pins.inputs[idx];
+    axes_signals_t pin = xbar_fn_to_axismask(input->id);
 
-//*************************  LIMIT  *************************//
+    if(idx >= count_of(limit_latch.pin) || !(pin.mask & (input->group == PinGroup_Limit ? homing_source.min.mask : homing_source.max.mask)))
+        return false;
+
+    memset(&limit_latch.pin[idx], 0, sizeof(limit_latch_t));
+    limit_latch.pin[idx].axis = (uint8_t)(__builtin_ffs(pin.mask) - 1);
+    limit_latch.armed |= 1u << idx;
+
+    return true;
+}
+
+#endif // LIMIT_LATCH_ENABLE
 
 // Enable/disable limit pins interrupt
 static void limitsEnable (bool on, axes_signals_t homing_cycle)
@@ -1148,17 +3032,32 @@ static void limitsEnable (bool on, axes_signals_t homing_cycle)
     bool disable = !on;
     uint32_t i = limit_inputs.n_pins;
     axes_signals_t pin;
+    pin_irq_mode_t irq_mode;
     limit_signals_t homing_source = xbar_get_homing_source_from_cycle(homing_cycle);
 
     on = on && settings.limits.flags.hard_enabled;
 
+#if LIMIT_LATCH_ENABLE
+    limit_latch.armed = 0;
+#endif
+#if STEP_GATE_ENABLE
+    if(step_gate.limit)
+        step_gate_arm(on && !homing_cycle.mask);
+#endif
+
     do {
         i--;
         if(on && homing_cycle.mask) {
             pin = xbar_fn_to_axismask(limit_inputs.pins.inputs[i].id);
             disable = limit_inputs.pins.inputs[i].group == PinGroup_Limit ? (pin.mask & homing_source.min.mask) : (pin.mask & homing_source.max.mask);
         }
-        pinEnableIRQ(&limit_inputs.pins.inputs[i], disable ? IRQ_Mode_None : limit_inputs.pins.inputs[i].mode.irq_mode);
+        irq_mode = disable ? IRQ_Mode_None : limit_inputs.pins.inputs[i].mode.irq_mode;
+#if LIMIT_LATCH_ENABLE
+        // Homing switches interrupt on the active edge to latch the trip position.
+        if(homing_cycle.mask && limit_latch_arm(i, homing_source))
+            irq_mode = limit_inputs.pins.inputs[i].mode.irq_mode;
+#endif
+        pinEnableIRQ(&limit_inputs.pins.inputs[i], irq_mode);
     } while (i);
 
 #if TRINAMIC_ENABLE
@@ -1168,7 +3067,7 @@ static void limitsEnable (bool on, axes_signals_t homing_cycle)
 
 // Returns limit state as an limit_signals_t variable.
 // Each bitfield bit indicates an axis limit, where triggered is 1 and not triggered is 0.
-inline static limit_signals_t limitsGetState (void)
+static limit_signals_t __not_in_flash_func(limitsGetState)(void)
 {
     limit_signals_t signals = {0};
 
@@ -1197,6 +3096,94 @@ inline static limit_signals_t limitsGetState (void)
     return signals;
 }
 
+#if LIMIT_LATCH_ENABLE
+
+// Homing switch state polled by the homing cycle, confirms latched trips and discards trips of released switches.
+static limit_signals_t limitsGetHomingState (void)
+{
+    uint32_t armed = limit_latch.armed;
+
+    while(armed) {
+
+        uint_fast8_t idx = __builtin_ctz(armed);
+        limit_latch_t *latch = &limit_latch.pin[idx];
+
+        ATOMIC_ENTER();
+
+        armed &= ~(1u << idx);
+
+        if(DIGITAL_IN(limit_inputs.pins.inputs[idx].bit)) {
+            if(!latch->stopped) {
+                latch->stopped = true;
+                if((latch->valid = latch->tripped)) {
+                    latch->overshoot = sys.position[latch->axis] - latch->trip_position;
+                    latch->latency = time_us_32() - latch->trip_time;
+                }
+            }
+        } else
+            latch->tripped = latch->stopped = false;
+
+        ATOMIC_EXIT();
+    }
+
+    return limitsGetState();
+}
+
+// Corrects the homed machine position by the overshoot latched for the first homing switch of each axis,
+// the primary switch of ganged axes. The overshoot of the secondary switch is reported by $LIMLATCH.
+static void onHomingCompleted (axes_signals_t cycle, bool success)
+{
+    uint_fast8_t idx;
+    axes_signals_t corrected = {0};
+
+    if(success) {
+        for(idx = 0; idx < min(limit_inputs.n_pins, count_of(limit_latch.pin)); idx++) {
+            limit_latch_t *latch = &limit_latch.pin[idx];
+            if(latch->valid && bit_istrue(cycle.mask, bit(latch->axis)) && !bit_istrue(corrected.mask, bit(latch->axis))) {
+                corrected.mask |= bit(latch->axis);
+                sys.position[latch->axis] += latch->overshoot;
+            }
+        }
+        if(corrected.mask) {
+            plan_sync_position();
+            gc_sync_position();
+        }
+    }
+
+    if(on_homing_completed)
+        on_homing_completed(cycle, success);
+}
+
+// $LIMLATCH - reports the homing switches latched in the last homing cycle: switch, trip position, steps from trip to stop
+// and microseconds from the switch edge to the trip being confirmed.
+static status_code_t limit_latch_report (sys_state_t state)
+{
+    uint_fast8_t idx;
+
+    UNUSED(state);
+
+    for(idx = 0; idx < min(limit_inputs.n_pins, count_of(limit_latch.pin)); idx++) {
+        limit_latch_t *latch = &limit_latch.pin[idx];
+        if(latch->valid) {
+            hal.stream.write("[LIMLATCH:");
+            hal.stream.write(xbar_fn_to_pinname(limit_inputs.pins.inputs[idx].id));
+            hal.stream.write(",");
+            hal.stream.write(latch->trip_position < 0 ? "-" : "");
+            hal.stream.write(uitoa(latch->trip_position < 0 ? -latch->trip_position : latch->trip_position));
+            hal.stream.write(",");
+            hal.stream.write(latch->overshoot < 0 ? "-" : "");
+            hal.stream.write(uitoa(latch->overshoot < 0 ? -latch->overshoot : latch->overshoot));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(latch->latency));
+            hal.stream.write("]" ASCII_EOL);
+        }
+    }
+
+    return Status_OK;
+}
+
+#endif // LIMIT_LATCH_ENABLE
+
 // Returns system state as a control_signals_t variable.
 // Each bitfield bit indicates a control signal, where triggered is 1 and not triggered is 0.
 static control_signals_t __not_in_flash_func(systemGetState)(void)
@@ -1273,7 +3260,7 @@ static void __not_in_flash_func(aux_irq_handler) (uint8_t port, bool state)
     for(i = 0; i < AuxCtrl_NumEntries; i++) {
         if(aux_ctrl[i].port == port) {
             if(!aux_ctrl[i].debouncing) {
-                if(i == AuxCtrl_SafetyDoor && (aux_ctrl[i].debouncing = add_alarm_in_ms(DEBOUNCE_DELAY, aux_irq_latch, NULL, false)))
+                if(i == AuxCtrl_SafetyDoor && (aux_ctrl[i].debouncing = debounce_alarm_in_ms(DEBOUNCE_DELAY, aux_irq_latch, NULL, false)))
                     break;
                 signals.mask |= aux_ctrl[i].cap.mask;
                 if(aux_ctrl[i].irq_mode == IRQ_Mode_Change)
@@ -1336,10 +3323,155 @@ static bool aux_claim_explicit (aux_ctrl_t *aux_ctrl)
 
 #endif // AUX_CONTROLS_ENABLED
 
+#if AXIS_ENCODER_ENABLE || SPINDLE_ENCODER_ENABLE || SPINDLE_PID_ENABLE || STEP_FOLLOWER_ENABLE
+
+typedef struct {
+    uint8_t pin;
+    const char *description;
+} aux_input_claim_t;
+
+static bool aux_input_claim_pin (xbar_t *properties, uint8_t port, void *data)
+{
+    return properties->pin == ((aux_input_claim_t *)data)->pin &&
+            ioport_claim(Port_Digital, Port_Input, &port, ((aux_input_claim_t *)data)->description);
+}
+
+// Claims the aux input the board map assigns to a pin used directly by a driver module, e.g. by a PIO program.
+bool aux_input_claim (uint8_t pin, const char *description)
+{
+    aux_input_claim_t claim = { .pin = pin, .description = description };
+
+    return ioports_enumerate(Port_Digital, Port_Input, (pin_cap_t){ .claimable = On }, aux_input_claim_pin, &claim);
+}
+
+#endif
+
 //*************************  PROBE  *************************//
 
+#if PROBE_LATCH_ENABLE && (!defined(PROBE_PIN) || STEP_PORT == GPIO_SR8 || DIRECTION_PORT != GPIO_OUTPUT)
+#error "Probe position latch requires a probe input, GPIO or PIO step outputs and GPIO direction outputs!"
+#endif
+
 #ifdef PROBE_PIN
 
+#if PROBE_LATCH_ENABLE
+
+// Probe position latch, a spare PIO state machine per axis counts the step pulses output during probing.
+// Counting is stalled by the probe input in the PIO and the state machines are stopped by the probe interrupt,
+// the step position at the trigger instant replaces the position captured by the stepper interrupt.
+
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint offset;
+} step_counter_t;
+
+static struct {
+    bool enabled;
+    volatile bool armed;
+    volatile bool triggered;
+    uint32_t sm_mask[2];
+    int32_t position[N_AXIS];
+    step_counter_t counter[N_AXIS];
+} probe_latch = {0};
+
+static void __not_in_flash_func(probe_latch_stop)(void)
+{
+    pio_set_sm_mask_enabled(pio0, probe_latch.sm_mask[0], false);
+    pio_set_sm_mask_enabled(pio1, probe_latch.sm_mask[1], false);
+    probe_latch.armed = false;
+}
+
+// Called on probe trigger.
+static void __not_in_flash_func(probe_latch_freeze)(void)
+{
+    if(probe_latch.armed) {
+        probe_latch_stop();
+        probe_latch.triggered = true;
+    }
+}
+
+static void probe_latch_arm (void)
+{
+    uint_fast8_t idx = N_AXIS;
+
+    probe_latch_stop();
+
+    do {
+        idx--;
+        step_counter_program_init(probe_latch.counter[idx].pio, probe_latch.counter[idx].sm, probe_latch.counter[idx].offset, axis_step_pin[idx], axis_dir_pin[idx]);
+        // Invert the input of inverted step signals so the state machine sees active high step pulses.
+        gpio_set_inover(axis_step_pin[idx], bit_istrue(settings.steppers.step_invert.mask, bit(idx)) ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+    } while(idx);
+
+    memcpy(probe_latch.position, sys.position, sizeof(probe_latch.position));
+    probe_latch.triggered = false;
+    probe_latch.armed = true;
+
+    pio_set_sm_mask_enabled(pio0, probe_latch.sm_mask[0], true);
+    pio_set_sm_mask_enabled(pio1, probe_latch.sm_mask[1], true);
+}
+
+// Replaces the probe position captured by the stepper interrupt with the latched position if the probe was triggered.
+static void probe_latch_disarm (void)
+{
+    uint_fast8_t idx = N_AXIS;
+
+    probe_latch_stop();
+
+    do {
+        idx--;
+        if(probe_latch.triggered) {
+            // A direction signal at active level is motion in the negative direction.
+            int32_t count = step_counter_get_count(probe_latch.counter[idx].pio, probe_latch.counter[idx].sm);
+            sys.probe_position[idx] = probe_latch.position[idx] + (bit_istrue(settings.steppers.dir_invert.mask, bit(idx)) ? count : -count);
+        }
+        gpio_set_inover(axis_step_pin[idx], GPIO_OVERRIDE_NORMAL);
+    } while(idx);
+
+    probe_latch.triggered = false;
+}
+
+// Claims a state machine per axis and loads the step counter program, called from driver_init() after the driver state machines are claimed.
+static bool probe_latch_init (void)
+{
+    int sm;
+    uint_fast8_t idx, i;
+    int offset[2] = { -1, -1 };
+    PIO pio[] = { pio0, pio1 };
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        for(i = 0; i < 2; i++) {
+            if(offset[i] == -1 && (offset[i] = step_counter_program_load(pio[i], PROBE_PIN)) == -1)
+                continue;
+            if((sm = pio_claim_unused_sm(pio[i], false)) != -1) {
+                probe_latch.counter[idx].pio = pio[i];
+                probe_latch.counter[idx].sm = (uint)sm;
+                probe_latch.counter[idx].offset = (uint)offset[i];
+                probe_latch.sm_mask[i] |= 1u << sm;
+                break;
+            }
+        }
+        if(i == 2)
+            break;
+    }
+
+    // Release the state machines if there are not enough for all axes, probing falls back to the stepper interrupt position.
+    if(!(probe_latch.enabled = idx == N_AXIS)) {
+        for(i = 0; i < 2; i++) {
+            for(sm = 0; sm < 4; sm++) {
+                if(probe_latch.sm_mask[i] & (1u << sm))
+                    pio_sm_unclaim(pio[i], (uint)sm);
+            }
+            probe_latch.sm_mask[i] = 0;
+        }
+    }
+
+    return probe_latch.enabled;
+}
+
+#endif // PROBE_LATCH_ENABLE
+
 // Sets up the probe pin invert mask to
 // appropriately set the pin logic according to setting for normal-high/normal-low operation
 // and the probing cycle modes for toward-workpiece/away-from-workpiece.
@@ -1350,14 +3482,23 @@ static void probeConfigure (bool is_probe_away, bool probing)
 
     gpio_set_inover(PROBE_PIN, probe.inverted ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
 
+#if PROBE_LATCH_ENABLE
+    if(probe_latch.enabled) {
+        if(probing)
+            probe_latch_arm();
+        else
+            probe_latch_disarm();
+    }
+#endif
+
     if ((probe.is_probing = probing))
-        gpio_set_irq_enabled(PROBE_PIN, probe.inverted ? GPIO_IRQ_LEVEL_LOW : GPIO_IRQ_LEVEL_HIGH, true);
+        gpio_irq_enable(PROBE_PIN, probe.inverted ? GPIO_IRQ_LEVEL_LOW : GPIO_IRQ_LEVEL_HIGH, true);
     else
-        gpio_set_irq_enabled(PROBE_PIN, GPIO_IRQ_ALL, false);
+        gpio_irq_enable(PROBE_PIN, GPIO_IRQ_ALL, false);
 }
 
 // Returns the probe connected and triggered pin states.
-static probe_state_t probeGetState (void)
+static probe_state_t __not_in_flash_func(probeGetState)(void)
 {
     probe_state_t state = {0};
 
@@ -1371,6 +3512,36 @@ static probe_state_t probeGetState (void)
 
 //*************************  SPINDLE  *************************//
 
+#if PPI_ENABLE
+
+#if !(DRIVER_SPINDLE_PWM_ENABLE && SPINDLE_PORT == GPIO_OUTPUT && defined(SPINDLE_ENABLE_PIN))
+#error "PPI requires a PWM spindle with a GPIO spindle enable output!"
+#endif
+
+// Laser pulses are output on the spindle enable pin by a PIO one-shot, the pin is switched to the PIO
+// on the first pulse and back to SIO on normal spindle on/off. Function select only, pad and override
+// (spindle enable invert) settings are kept.
+static struct {
+    PIO pio;
+    uint sm;
+    volatile bool pio_owned;
+} ppi = {0};
+
+static inline void ppi_pin_function (uint32_t fn)
+{
+    hw_write_masked(&iobank0_hw->io[SPINDLE_ENABLE_PIN].ctrl, fn << IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB, IO_BANK0_GPIO0_CTRL_FUNCSEL_BITS);
+}
+
+static inline void ppi_release_pin (void)
+{
+    if(ppi.pio_owned) {
+        ppi.pio_owned = false;
+        ppi_pin_function(GPIO_FUNC_SIO);
+    }
+}
+
+#endif // PPI_ENABLE
+
 #if DRIVER_SPINDLE_ENABLE
 
 // Static spindle (off, on cw & on ccw)
@@ -1378,6 +3549,10 @@ inline static void spindle_off (void)
 {
 #if SPINDLE_PORT == GPIO_OUTPUT
 
+#if PPI_ENABLE
+    ppi_release_pin();
+#endif
+
 #ifdef SPINDLE_ENABLE_PIN
     DIGITAL_OUT(SPINDLE_ENABLE_BIT, Off);
 #endif
@@ -1389,8 +3564,10 @@ inline static void spindle_off (void)
 
 #elif SPINDLE_PORT == GPIO_SR16
 
+    out_sr_hold();
     out_sr.spindle_ena = settings.spindle.invert.on;
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 
 #endif
 }
@@ -1399,6 +3576,10 @@ inline static void spindle_on (void)
 {
 #if SPINDLE_PORT == GPIO_OUTPUT
 
+#if PPI_ENABLE
+    ppi_release_pin();
+#endif
+
 #ifdef SPINDLE_ENABLE_PIN
     DIGITAL_OUT(SPINDLE_ENABLE_BIT, On);
 #endif
@@ -1410,8 +3591,10 @@ inline static void spindle_on (void)
 
 #elif SPINDLE_PORT == GPIO_SR16
 
+    out_sr_hold();
     out_sr.spindle_ena = !settings.spindle.invert.on;
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 
 #endif
 }
@@ -1431,8 +3614,10 @@ inline static void spindle_dir (bool ccw)
 
 #elif SPINDLE_PORT == GPIO_SR16
 
+    out_sr_hold();
     out_sr.spindle_dir = ccw ^ settings.spindle.invert.ccw;
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 
 #endif
 }
@@ -1443,18 +3628,40 @@ static void spindleSetState (spindle_ptrs_t *spindle, spindle_state_t state, flo
     UNUSED(rpm);
     UNUSED(spindle);
 
+#if SPINDLE_PORT == GPIO_SR16
+    out_sr_hold();
+#endif
+
     if(!state.on)
         spindle_off();
     else {
         spindle_dir(state.ccw);
         spindle_on();
     }
+
+#if SPINDLE_PORT == GPIO_SR16
+    out_sr_release();
+#endif
 }
 
 #if DRIVER_SPINDLE_PWM_ENABLE
 
 // Variable spindle control functions
 
+// Sets the PWM compare value unless the level is controlled by hardware
+static inline void spindle_pwm_level (uint_fast16_t level)
+{
+#if LASER_RASTER_ENABLE
+    if(laser_raster_active()) // The scanline owns the PWM level while output
+        return;
+#endif
+#if LASER_VELOCITY_ENABLE
+    if(laser_velocity_set_level(level)) // Output from the velocity lookup table
+        return;
+#endif
+    pwm_set_gpio_level(SPINDLE_PWM_PIN, level);
+}
+
 // Sets spindle speed
 static void __not_in_flash_func(spindleSetSpeed)(spindle_ptrs_t *spindle, uint_fast16_t pwm_value)
 {
@@ -1466,10 +3673,7 @@ static void __not_in_flash_func(spindleSetSpeed)(spindle_ptrs_t *spindle, uint_f
             else
                 spindle_off();
         }
-        if (pwm(spindle)->always_on)
-            pwm_set_gpio_level(SPINDLE_PWM_PIN, pwm(spindle)->off_value);
-        else
-            pwm_set_gpio_level(SPINDLE_PWM_PIN, 0);
+        spindle_pwm_level(pwm(spindle)->always_on ? pwm(spindle)->off_value : 0);
     } else {
         if (!pwmEnabled) {
             if(pwm(spindle)->cloned)
@@ -1478,7 +3682,7 @@ static void __not_in_flash_func(spindleSetSpeed)(spindle_ptrs_t *spindle, uint_f
                 spindle_on();
             pwmEnabled = true;
         }
-        pwm_set_gpio_level(SPINDLE_PWM_PIN, pwm_value);
+        spindle_pwm_level(pwm_value);
     }
 }
 
@@ -1490,6 +3694,21 @@ static uint_fast16_t spindleGetPWM (spindle_ptrs_t *spindle, float rpm)
 // Start or stop spindle
 static void spindleSetStateVariable (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
 {
+#if LASER_RASTER_ENABLE
+    if(!state.on)
+        laser_raster_stop();
+#endif
+#if LASER_VELOCITY_ENABLE
+    laser_velocity_enable(state.on && !state.ccw);
+#endif
+#if SPINDLE_PID_ENABLE
+    spindle_pid_set_rpm(state.on && settings.mode != Mode_Laser ? rpm : 0.0f);
+#endif
+
+#if SPINDLE_PORT == GPIO_SR16
+    out_sr_hold();
+#endif
+
     if(state.on || pwm(spindle)->cloned)
         spindle_dir(state.ccw);
 
@@ -1503,6 +3722,10 @@ static void spindleSetStateVariable (spindle_ptrs_t *spindle, spindle_state_t st
     spindleSetSpeed(spindle, state.on || (state.ccw && pwm(spindle)->cloned)
                               ? pwm(spindle)->compute_value(pwm(spindle), rpm, false)
                               : pwm(spindle)->off_value);
+
+#if SPINDLE_PORT == GPIO_SR16
+    out_sr_release();
+#endif
 }
 
 bool spindleConfig (spindle_ptrs_t *spindle)
@@ -1510,17 +3733,16 @@ bool spindleConfig (spindle_ptrs_t *spindle)
     if (spindle == NULL)
         return false;
 
-    uint32_t prescaler = settings.spindle.pwm_freq > 2000.0f ? 1 : (settings.spindle.pwm_freq > 200.0f ? 12 : 50);
-
-    if (spindle_precompute_pwm_values(spindle, &spindle_pwm, &settings.spindle, clock_get_hz(clk_sys) / prescaler)) {
+    if (pwm_divider_solve(clock_get_hz(clk_sys), settings.spindle.pwm_freq, &spindle_pwm_div) &&
+         spindle_precompute_pwm_values(spindle, &spindle_pwm, &settings.spindle, spindle_pwm_div.clock_hz)) {
 
         spindle->set_state = spindleSetStateVariable;
 
         // Get the default config for
         pwm_config config = pwm_get_default_config();
 
-        // Set divider, not using the 4 fractional bit part of the clock divider, only the integer part
-        pwm_config_set_clkdiv_int(&config, prescaler);
+        // Set the 8.4 fractional divider selected for maximum resolution at the requested frequency
+        pwm_config_set_clkdiv_int_frac(&config, spindle_pwm_div.div16 >> 4, spindle_pwm_div.div16 & 0x0F);
         // Set the top value of the PWM => the period
         pwm_config_set_wrap(&config, spindle_pwm.period);
         // Set the off value of the PWM => off duty cycle (either 0 or the off value)
@@ -1545,12 +3767,19 @@ bool spindleConfig (spindle_ptrs_t *spindle)
 
 #if PPI_ENABLE
 
-static void spindlePulseOn (uint_fast16_t pulse_length)
+// Outputs a laser pulse of pulse_length microseconds, called by the PPI plugin from the stepper interrupt.
+// The pulse is ended by the PIO, no timer interrupt is involved.
+static void __not_in_flash_func(spindlePulseOn)(uint_fast16_t pulse_length)
 {
-    //    PPI_TIMER->ARR = pulse_length;
-    //    PPI_TIMER->EGR = TIM_EGR_UG;
-    //    PPI_TIMER->CR1 |= TIM_CR1_CEN;
-    spindle_on();
+    if(ppi.pio == NULL)
+        return;
+
+    if(!ppi.pio_owned) {
+        ppi.pio_owned = true;
+        ppi_pin_function(ppi.pio == pio0 ? GPIO_FUNC_PIO0 : GPIO_FUNC_PIO1);
+    }
+
+    one_shot_pulse(ppi.pio, ppi.sm, (uint32_t)pulse_length * (PPI_PIO_CLOCK / 1000000));
 }
 
 #endif // PPI_ENABLE
@@ -1589,6 +3818,10 @@ static spindle_state_t spindleGetState (spindle_ptrs_t *spindle)
 
     state.value ^= settings.spindle.invert.mask;
 
+#if SPINDLE_PID_ENABLE
+    state.at_speed = state.on && spindle_pid_at_speed();
+#endif
+
     return state;
 }
 
@@ -1618,9 +3851,11 @@ static void coolantSetState (coolant_state_t mode)
 #elif COOLANT_PORT == GPIO_SR16
 
     mode.value ^= settings.coolant_invert.mask;
+    out_sr_hold();
     out_sr.flood_ena = mode.flood;
     out_sr.mist_ena = mode.mist;
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 
 #endif
 }
@@ -1663,36 +3898,38 @@ static coolant_state_t coolantGetState (void)
 
 void spi_reset_out (bool on)
 {
+    out_sr_hold();
     out_sr.spi_reset = on;
-    out_sr16_write(pio1, out_sr_sm, out_sr.value);
+    out_sr_update();
+    out_sr_release();
 }
 
 #endif
 
 // Helper functions for setting/clearing/inverting individual bits atomically (uninterruptable)
-static void bitsSetAtomic (volatile uint_fast16_t *ptr, uint_fast16_t bits)
+static void __not_in_flash_func(bitsSetAtomic)(volatile uint_fast16_t *ptr, uint_fast16_t bits)
 {
-    __disable_irq();
+    ATOMIC_ENTER();
     *ptr |= bits;
-    __enable_irq();
+    ATOMIC_EXIT();
 }
 
-static uint_fast16_t bitsClearAtomic (volatile uint_fast16_t *ptr, uint_fast16_t bits)
+static uint_fast16_t __not_in_flash_func(bitsClearAtomic)(volatile uint_fast16_t *ptr, uint_fast16_t bits)
 {
-    __disable_irq();
+    ATOMIC_ENTER();
     uint_fast16_t prev = *ptr;
     *ptr &= ~bits;
-    __enable_irq();
+    ATOMIC_EXIT();
 
     return prev;
 }
 
-static uint_fast16_t valueSetAtomic (volatile uint_fast16_t *ptr, uint_fast16_t value)
+static uint_fast16_t __not_in_flash_func(valueSetAtomic)(volatile uint_fast16_t *ptr, uint_fast16_t value)
 {
-    __disable_irq();
+    ATOMIC_ENTER();
     uint_fast16_t prev = *ptr;
     *ptr = value;
-    __enable_irq();
+    ATOMIC_EXIT();
 
     return prev;
 }
@@ -1745,31 +3982,172 @@ void pinEnableIRQ (const input_signal_t *input, pin_irq_mode_t irq_mode)
     switch (irq_mode) {
 
         case IRQ_Mode_Rising:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_EDGE_RISE, true);
+            gpio_irq_enable(input->pin, GPIO_IRQ_EDGE_RISE, true);
             break;
 
         case IRQ_Mode_Falling:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_EDGE_FALL, true);
+            gpio_irq_enable(input->pin, GPIO_IRQ_EDGE_FALL, true);
             break;
 
         case IRQ_Mode_Change:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+            gpio_irq_enable(input->pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
             break;
 
         case IRQ_Mode_Low:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_LEVEL_LOW, true);
+            gpio_irq_enable(input->pin, GPIO_IRQ_LEVEL_LOW, true);
             break;
 
         case IRQ_Mode_High:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_LEVEL_HIGH, true);
+            gpio_irq_enable(input->pin, GPIO_IRQ_LEVEL_HIGH, true);
             break;
 
         case IRQ_Mode_None:
-            gpio_set_irq_enabled(input->pin, GPIO_IRQ_ALL, false);
+            gpio_irq_enable(input->pin, GPIO_IRQ_ALL, false);
+            break;
+    }
+}
+
+#if STEP_PULSE_AXIS_ENABLE
+
+// Builds the stage sequence from the per axis settings, axes set to 0 use the $0 pulse length and $29 dir to step delay.
+// Stages closer than 4 PIO counts are delayed, the delay is not accumulated.
+static void step_axis_configure (settings_t *settings)
+{
+    uint_fast8_t idx, i, n = 0;
+    uint32_t on[N_AXIS], off[N_AXIS], times[N_AXIS * 2], t, start = 0;
+    float counts_per_us = (float)STEP_TIMER_CLOCK / 1000000.0f;
+    step_axis_stage_t stage[N_AXIS * 2];
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+
+        float delay = step_axis_settings.pulse_delay[idx] > 0.0f ? step_axis_settings.pulse_delay[idx] : settings->steppers.pulse_delay_microseconds,
+              length = step_axis_settings.pulse_length[idx] > 0.0f ? step_axis_settings.pulse_length[idx] : settings->steppers.pulse_microseconds;
+
+        on[idx] = (uint32_t)lroundf(delay * counts_per_us);
+        off[idx] = on[idx] + max(1, (uint32_t)lroundf(length * counts_per_us));
+
+        // Insert the start and end times in the sorted list of unique stage times.
+        for(t = on[idx]; ; t = off[idx]) {
+            for(i = 0; i < n && times[i] < t; i++);
+            if(i == n || times[i] != t) {
+                memmove(&times[i + 1], &times[i], (n - i) * sizeof(uint32_t));
+                times[i] = t;
+                n++;
+            }
+            if(t == off[idx])
+                break;
+        }
+    }
+
+    for(i = 0; i < n; i++) {
+        stage[i].wait = times[i] > start + 4 ? (uint8_t)min(255, times[i] - start - 4) : 0;
+        start += stage[i].wait + 4;
+        stage[i].active = 0;
+        for(idx = 0; idx < N_AXIS; idx++) {
+            if(on[idx] <= times[i] && off[idx] > times[i])
+                stage[i].active |= bit(idx);
+        }
+    }
+
+    if(n & 1) {
+        stage[n].wait = 0;
+        stage[n++].active = 0;
+    }
+
+    STEP_AXIS_LOCK();
+
+    memcpy(step_axis.stage, stage, n * sizeof(step_axis_stage_t));
+    step_axis.n_stages = n;
+
+    STEP_AXIS_UNLOCK();
+}
+
+static status_code_t step_axis_set (setting_id_t setting, float value)
+{
+    uint_fast8_t idx;
+
+    switch(settings_get_axis_base(setting, &idx)) {
+
+        case Setting_AxisExtended0:
+            step_axis_settings.pulse_length[idx] = value;
+            break;
+
+        case Setting_AxisExtended1:
+            step_axis_settings.pulse_delay[idx] = value;
             break;
+
+        default:
+            return Status_Unhandled;
+    }
+
+    step_axis_configure(&settings);
+
+    return Status_OK;
+}
+
+static float step_axis_get (setting_id_t setting)
+{
+    uint_fast8_t idx;
+
+    switch(settings_get_axis_base(setting, &idx)) {
+
+        case Setting_AxisExtended0:
+            return step_axis_settings.pulse_length[idx];
+
+        case Setting_AxisExtended1:
+            return step_axis_settings.pulse_delay[idx];
+
+        default:
+            return 0.0f;
     }
 }
 
+static const setting_detail_t step_axis_setting_detail[] = {
+    { Setting_AxisExtended0, Group_Axis0, "-axis step pulse length", "microseconds", Format_Decimal, "#0.0", "0.0", "25.0", Setting_NonCoreFn, step_axis_set, step_axis_get, NULL, { .subgroups = On, .increment = 1 } },
+    { Setting_AxisExtended1, Group_Axis0, "-axis step direction delay", "microseconds", Format_Decimal, "#0.0", "0.0", "25.0", Setting_NonCoreFn, step_axis_set, step_axis_get, NULL, { .subgroups = On, .increment = 1 } }
+};
+
+#ifndef NO_SETTINGS_DESCRIPTIONS
+
+static const setting_descr_t step_axis_setting_descr[] = {
+    { Setting_AxisExtended0, "Step pulse length for the axis, 0 to use the $0 setting." },
+    { Setting_AxisExtended1, "Step direction to step pulse delay for the axis, 0 to use the $29 setting." }
+};
+
+#endif
+
+static void step_axis_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(step_axis_nvs, (uint8_t *)&step_axis_settings, sizeof(step_axis_settings_t), true);
+}
+
+static void step_axis_settings_restore (void)
+{
+    memset(&step_axis_settings, 0, sizeof(step_axis_settings_t));
+
+    step_axis_settings_save();
+}
+
+static void step_axis_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&step_axis_settings, step_axis_nvs, sizeof(step_axis_settings_t), true) != NVS_TransferResult_OK)
+        step_axis_settings_restore();
+}
+
+static setting_details_t step_axis_setting_details = {
+    .settings = step_axis_setting_detail,
+    .n_settings = sizeof(step_axis_setting_detail) / sizeof(setting_detail_t),
+#ifndef NO_SETTINGS_DESCRIPTIONS
+    .descriptions = step_axis_setting_descr,
+    .n_descriptions = sizeof(step_axis_setting_descr) / sizeof(setting_descr_t),
+#endif
+    .save = step_axis_settings_save,
+    .load = step_axis_settings_load,
+    .restore = step_axis_settings_restore
+};
+
+#endif // STEP_PULSE_AXIS_ENABLE
+
 // Configures peripherals when settings are initialized or changed
 void settings_changed (settings_t *settings, settings_changed_flags_t changed)
 {
@@ -1827,27 +4205,28 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
 
 #endif
 
+        build_luts(settings);
+
+#if STEP_INJECT_ENABLE
+        // Drain mode ticks leave a step pulse length of low time after each pulse.
+        step_inject.drain_period = (uint32_t)ceilf((settings->steppers.pulse_delay_microseconds + settings->steppers.pulse_microseconds * 2.0f) * (float)hal.f_step_timer / 1000000.0f);
+#endif
+
 #if SD_SHIFT_REGISTER
-        pio_steps.length = (uint32_t)(10.0f * (settings->steppers.pulse_microseconds - 0.8f));
-        pio_steps.delay = settings->steppers.pulse_delay_microseconds <= 0.8f
+        // Shift out and latch time of a register image in microseconds, two T3 + 1 cycles per bit and one for the latch
+        // at the shift clock actually set, the system clock divided by the divider used by step_dir_sr4_program_init().
+        float sr_shift_time = (float)((SD_SHIFT_REGISTER * 2 + 1) * (step_dir_sr4_T3 + 1)) * max(1.0f, pio_clkdiv(SR_SHIFT_CLOCK)) * 1000000.0f / (float)clock_get_hz(clk_sys);
+
+        pio_steps.length = (uint32_t)(10.0f * (settings->steppers.pulse_microseconds - sr_shift_time));
+        pio_steps.delay = settings->steppers.pulse_delay_microseconds <= sr_shift_time
                               ? 2
-                              : (uint32_t)(10.0f * (settings->steppers.pulse_delay_microseconds - 0.8f));
+                              : (uint32_t)(10.0f * (settings->steppers.pulse_delay_microseconds - sr_shift_time));
         sr_delay_set(pio0, 1, pio_steps.delay);
         sr_hold_set(pio0, 2, pio_steps.length);
-        sd_sr.reset.x_step = settings->steppers.step_invert.x;
-#ifdef X2_DIRECTION_PIN
-        sd_sr.reset.m3_step = settings->steppers.step_invert.x;
-#endif
-        sd_sr.reset.y_step = settings->steppers.step_invert.y;
-#ifdef Y2_DIRECTION_PIN
-        sd_sr.reset.m3_step = settings->steppers.step_invert.y;
-#endif
-        sd_sr.reset.z_step = settings->steppers.step_invert.z;
-#ifdef Z2_DIRECTION_PIN
-        sd_sr.reset.m3_step = settings->steppers.step_invert.z;
-#endif
-#ifdef A_DIRECTION_PIN
-        sd_sr.reset.m3_step = settings->steppers.step_invert.a;
+#ifdef SQUARING_ENABLED
+        sd_sr.reset.value = (sd_sr.reset.value & SD_SR_DIR_BITS) | step_lut[0] | step_lut2[0];
+#else
+        sd_sr.reset.value = (sd_sr.reset.value & SD_SR_DIR_BITS) | step_lut[0];
 #endif
 
 #else // PIO step parameters init
@@ -1856,18 +4235,31 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
         pio_steps.delay = settings->steppers.pulse_delay_microseconds == 0.0f
                               ? 1
                               : (uint32_t)(10.0f * (settings->steppers.pulse_delay_microseconds)) - 1;
-        pio_steps.reset = settings->steppers.step_invert.mask;
-#ifdef X2_STEP_PIN
-        if (settings->steppers.step_invert.x)
-            pio_steps.reset |= X2_STEP_BIT;
+#if STEP_SELFTEST_ENABLE
+        pio_steps.length = max(1, min(255, (int32_t)pio_steps.length + pulse_length_adj));
+        if(settings->steppers.pulse_delay_microseconds > 0.0f)
+            pio_steps.delay = max(1, min(255, (int32_t)pio_steps.delay + pulse_delay_adj));
 #endif
-#ifdef Y2_STEP_PIN
-        if (settings->steppers.step_invert.y)
-            pio_steps.reset |= Y2_STEP_BIT;
+
+#if STEP_PULSE_AXIS_ENABLE
+        step_axis_configure(settings);
 #endif
-#ifdef Z2_STEP_PIN
-        if (settings->steppers.step_invert.z)
-            pio_steps.reset |= Z2_STEP_BIT;
+
+#if STEP_PORT == GPIO_PIO_1
+        for(uint_fast8_t i = 0; i < n_step_sm; i++) {
+            step_sm[i].idle = step_sm[i].map[0] | step_sm[i].map2[0];
+            step_pulse_map_set_idle(step_sm[i].pio, step_sm[i].sm, step_sm[i].idle);
+        }
+#elif defined(SQUARING_ENABLED)
+        pio_steps.reset = step_lut[0] | step_lut2[0];
+#else
+        pio_steps.reset = step_lut[0];
+#endif
+
+#if STEP_STREAM_ENABLE
+        stream.step_idle = (uint32_t)pio_steps.reset << stream.shift;
+        stream.dir = stepStreamDirImage((axes_signals_t){0});
+        stepStreamOutputIdle();
 #endif
 
 #endif
@@ -1879,11 +4271,21 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
          *  Input pins config  *
          ***********************/
 
-        // Set the GPIO interrupt handler, the pin doesn't matter for now
-        gpio_set_irq_enabled_with_callback(0, 0, false, gpio_int_handler);
+#if STEPPER_CORE1_ENABLE
+
+        // The GPIO IRQ handler is owned by core 1, see core1_main(). Its pin interrupt enables are cleared while initializing
+        // the input pins and restored afterwards for the pins not configured here, e.g. limit and aux inputs.
+        uint_fast8_t r;
+        uint32_t irq_inte[count_of(iobank0_hw->proc1_irq_ctrl.inte)], irq_configured[count_of(irq_inte)] = {0};
 
+        for(r = 0; r < count_of(irq_inte); r++) {
+            irq_inte[r] = gpio_irq_ctrl->inte[r];
+            gpio_irq_ctrl->inte[r] = 0;
+        }
+#else
         // Disable GPIO IRQ while initializing the input pins
         irq_set_enabled(IO_IRQ_BANK0, false);
+#endif
 
         bool pullup;
         uint32_t i = sizeof(inputpin) / sizeof(input_signal_t);
@@ -1910,7 +4312,7 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
 
             gpio_init(input->pin);
             if (!(input->group == PinGroup_Limit || input->group == PinGroup_AuxInput))
-                gpio_set_irq_enabled(input->pin, GPIO_IRQ_ALL, false);
+                gpio_irq_enable(input->pin, GPIO_IRQ_ALL, false);
 
             switch(input->id) {
 
@@ -2023,8 +4425,12 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
             gpio_set_pulls(input->pin, pullup, !pullup);
             gpio_set_inover(input->pin, input->invert ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
 
-            if (!(input->group == PinGroup_Limit || input->group == PinGroup_AuxInput))
+            if (!(input->group == PinGroup_Limit || input->group == PinGroup_AuxInput)) {
                 pinEnableIRQ(input, input->mode.irq_mode);
+#if STEPPER_CORE1_ENABLE
+                irq_configured[input->pin >> 3] |= 0xFu << (4 * (input->pin & 0x07));
+#endif
+            }
 
             if (input->id == Input_Probe)
                 probeConfigure(false, false);
@@ -2034,6 +4440,15 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
             gpio_acknowledge_irq(input->pin, GPIO_IRQ_ALL);
         } while (i);
 
+#if STEPPER_CORE1_ENABLE
+        for(r = 0; r < count_of(irq_inte); r++)
+            hw_set_bits(&gpio_irq_ctrl->inte[r], irq_inte[r] & ~irq_configured[r]);
+#endif
+
+#if STEP_GATE_ENABLE
+        step_gate_configure(settings);
+#endif
+
 #if AUX_CONTROLS_ENABLED
         for(i = 0; i < AuxCtrl_NumEntries; i++) {
             if(aux_ctrl[i].enabled && aux_ctrl[i].irq_mode != IRQ_Mode_None) {
@@ -2070,9 +4485,11 @@ void settings_changed (settings_t *settings, settings_changed_flags_t changed)
             }
         }
 
+#if !STEPPER_CORE1_ENABLE
         // Activate GPIO IRQ
         irq_set_priority(IO_IRQ_BANK0, NVIC_MEDIUM_LEVEL_PRIORITY); // By default all IRQ are medium priority but in case the GPIO IRQ would need high or low priority it can be done here
         irq_set_enabled(IO_IRQ_BANK0, true);                        // Enable GPIO IRQ
+#endif
     }
 }
 
@@ -2292,6 +4709,10 @@ static bool driver_setup (settings_t *settings)
         }
     }
 
+#if STEP_STREAM_ENABLE
+    stepStreamInit(); // Hands step and direction pins over to the PIO.
+#endif
+
 #if SDCARD_ENABLE
     sdcard_init();
 #endif
@@ -2362,27 +4783,102 @@ uint32_t get_free_mem (void)
 
 #if STEP_PORT == GPIO_PIO_1
 
-static bool assign_step_sm (PIO *pio, uint *sm, uint32_t pin)
+// Groups the step pins in 16 pin windows and assigns a state machine to each group,
+// pio1 is used first, pio0 when no more state machines are available.
+static bool assign_step_sms (void)
 {
-    static uint offset = 0xFFFF;
+    PIO pio = pio1;
+    int32_t sm;
+    uint offset = pio_add_program(pio1, &step_pulse_map_program);
+    uint32_t i, pins = 0;
+
+    for(i = 0; i < sizeof(step_pin); i++) {
+        if(step_pin[i] != 0xFF)
+            pins |= 1 << step_pin[i];
+    }
 
-    int32_t step_sm;
+    for(i = 0; i < sizeof(step2_pin); i++) {
+        if(step2_pin[i] != 0xFF)
+            pins |= 1 << step2_pin[i];
+    }
 
-    if(offset == 0xFFFF)
-        offset = pio_add_program(*pio, &step_pulse_program);
+    while(pins) {
 
-    if((step_sm = pio_claim_unused_sm(*pio, false)) == -1 && *pio == pio1) {
-        *pio = pio0;
-        step_sm = pio_claim_unused_sm(pio0, false);
-        offset = pio_add_program(pio0, &step_pulse_program);
-    }
+        step_sm_t *step = &step_sm[n_step_sm];
 
-    if(step_sm != -1) {
-        *sm = (uint)step_sm;
-        step_pulse_program_init(*pio, *sm, offset, pin, 1);
+        step->base = __builtin_ctz(pins);
+        step->pins = pins & (0xFFFF << step->base);
+        pins &= ~step->pins;
+
+        if((sm = pio_claim_unused_sm(pio, false)) == -1 && pio == pio1) {
+            pio = pio0;
+            offset = pio_add_program(pio0, &step_pulse_map_program);
+            sm = pio_claim_unused_sm(pio0, false);
+        }
+
+        if(sm == -1)
+            return false;
+
+        step->pio = pio;
+        step->sm = (uint)sm;
+        step->offset = offset;
+
+        step_pulse_map_program_init(pio, step->sm, offset, step->base, 32 - __builtin_clz(step->pins) - step->base, step->pins, pio_clkdiv(STEP_TIMER_CLOCK));
+
+        n_step_sm++;
     }
 
-    return step_sm != -1;
+    return true;
+}
+
+#endif
+
+#if STEPPER_CORE1_ENABLE
+
+// Core 1 entry point, claims the stepper and GPIO interrupts and then sleeps between interrupts.
+static void core1_main (void)
+{
+    multicore_lockout_victim_init(); // Allow core 0 to pause core 1 while flash is written.
+
+    core1_alarm_pool = alarm_pool_create(1, 16); // Debounce alarms are serviced by core 1 using hardware alarm 1.
+
+#if STEPPER_TIMING_ENABLE
+    // Free running core 1 SysTick for stepper interrupt timing
+    systick_hw->rvr = 0xFFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+#endif
+
+    irq_set_exclusive_handler(PIO1_IRQ_0, stepper_int_handler);
+    irq_set_enabled(PIO1_IRQ_0, true); // Stepper timer is gated by the PIO interrupt enable register.
+
+#if OUT_SHIFT_REGISTER
+    irq_set_priority(out_sr_ctl.irq, PICO_LOWEST_IRQ_PRIORITY);
+    irq_set_enabled(out_sr_ctl.irq, true);
+#endif
+
+#if STEPPER_DDA_ENABLE
+    stepper_dda_init(); // The interpolators are core local
+#endif
+
+#if STEP_STREAM_ENABLE
+    irq_set_exclusive_handler(DMA_IRQ_1, step_stream_dma_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+  #if SYNC_OUTPUT_ENABLE
+    irq_set_exclusive_handler(PIO0_IRQ_0, sync_output_irq);
+    irq_set_priority(PIO0_IRQ_0, PICO_HIGHEST_IRQ_PRIORITY); // Preempts the block fill
+    irq_set_enabled(PIO0_IRQ_0, true);
+  #endif
+#endif
+
+    gpio_irq_init();
+    irq_set_priority(IO_IRQ_BANK0, NVIC_MEDIUM_LEVEL_PRIORITY);
+    irq_set_enabled(IO_IRQ_BANK0, true);
+
+    core1_ready = true;
+
+    while(true)
+        __wfi();
 }
 
 #endif
@@ -2395,9 +4891,28 @@ bool driver_init (void)
 
     // irq_set_exclusive_handler(-1, systick_handler);
 
+#if SYS_CLOCK_KHZ != 125000
+    // Everything clocked from the system clock is set up from clock_get_hz(clk_sys) below, clk_peri follows clk_sys.
+    // SysTick and the microsecond timer are clocked from the crystal and are not affected.
+  #if SYS_CLOCK_KHZ > 200000
+    vreg_set_voltage(VREG_VOLTAGE_1_15);
+    busy_wait_us(1000);
+  #endif
+    if(!set_sys_clock_khz(SYS_CLOCK_KHZ, false))
+        protocol_enqueue_foreground_task(report_plain, "System clock frequency not available, running at 125 MHz");
+#endif
+
+#if STEPPER_TIMING_ENABLE && !STEPPER_CORE1_ENABLE
+    // Clock SysTick from the system clock for cycle resolution timestamps, still interrupting every ms.
+    systick_cycles = clock_get_hz(clk_sys) / 1000;
+    systick_hw->rvr = systick_cycles - 1;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_TICKINT_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+#else
     systick_hw->rvr = 999;
     systick_hw->cvr = 0;
     systick_hw->csr = M0PLUS_SYST_CSR_TICKINT_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+#endif
 
     hal.info = "RP2040";
     hal.driver_version = "240205";
@@ -2411,8 +4926,12 @@ bool driver_init (void)
 #endif
 
     hal.driver_setup = driver_setup;
-    hal.f_step_timer = 10000000;
+    hal.f_step_timer = STEP_TIMER_CLOCK;
     hal.f_mcu = clock_get_hz(clk_sys) / 1000000UL;
+#if STEPPER_TIMING_ENABLE
+    stepper_timing.cycles_per_tick2 = (uint32_t)(2ULL * clock_get_hz(clk_sys) / hal.f_step_timer);
+    timing_clear();
+#endif
     hal.rx_buffer_size = RX_BUFFER_SIZE;
     hal.get_free_mem = get_free_mem;
     hal.delay_ms = driver_delay;
@@ -2433,9 +4952,18 @@ bool driver_init (void)
 #if STEP_INJECT_ENABLE
     hal.stepper.output_step = stepperOutputStep;
 #endif
+#if STEP_STREAM_ENABLE
+    hal.stepper.wake_up = stepStreamWakeUp;
+    hal.stepper.go_idle = stepStreamGoIdle;
+    hal.stepper.cycles_per_tick = stepStreamCyclesPerTick;
+    hal.stepper.pulse_start = stepStreamPulseStart;
+#endif
 
     hal.limits.enable = limitsEnable;
     hal.limits.get_state = limitsGetState;
+#if LIMIT_LATCH_ENABLE
+    hal.homing.get_state = limitsGetHomingState;
+#endif
 
     hal.coolant.set_state = coolantSetState;
     hal.coolant.get_state = coolantGetState;
@@ -2504,6 +5032,9 @@ bool driver_init (void)
             .variable = On,
             .laser = On,
             .pwm_invert = On,
+  #if SPINDLE_PID_ENABLE
+            .at_speed = On,
+  #endif
   #if DRIVER_SPINDLE_DIR_ENABLE
             .direction = On
   #endif
@@ -2615,6 +5146,10 @@ bool driver_init (void)
         ioports_init(&aux_inputs, &aux_outputs);
 #endif
 
+#if OUT_SHIFT_REGISTER
+    out_sr_flush_init(); // The shadow register lock must be claimed before it is changed
+#endif
+
 #ifdef HAS_BOARD_INIT
 #if OUT_SHIFT_REGISTER
     board_init(&aux_inputs, &aux_outputs, &out_sr);
@@ -2699,72 +5234,69 @@ bool driver_init (void)
 
     stepper_timer_sm = pio_claim_unused_sm(pio1, false);
     stepper_timer_sm_offset = pio_add_program(pio1, &stepper_timer_program);
-    stepper_timer_program_init(pio1, stepper_timer_sm, stepper_timer_sm_offset, 12.5f); // 10MHz
+    stepper_timer_program_init(pio1, stepper_timer_sm, stepper_timer_sm_offset, pio_clkdiv(STEP_TIMER_CLOCK));
 
+#if STEPPER_CORE1_ENABLE
+    atomic_lock = spin_lock_init(spin_lock_claim_unused(true));
+  #if STEP_PULSE_AXIS_ENABLE
+    step_axis.lock = spin_lock_init(spin_lock_claim_unused(true));
+  #endif
+    multicore_launch_core1(core1_main);
+    while(!core1_ready);
+#else
     //    irq_add_shared_handler(PIO1_IRQ_0, stepper_int_handler, 0);
     irq_set_exclusive_handler(PIO1_IRQ_0, stepper_int_handler);
     //    irq_set_priority(PIO1_IRQ_0, 0);
-
-#if STEP_PORT == GPIO_PIO_1
-
-    z_step_pio = pio1;
-
-    assign_step_sm(&z_step_pio, &x_step_sm, X_STEP_PIN);
-    assign_step_sm(&z_step_pio, &y_step_sm, Y_STEP_PIN);
-    assign_step_sm(&z_step_pio, &z_step_sm, Z_STEP_PIN);
-
-#if N_ABC_MOTORS
-
-#if WIFI_ENABLE && N_ABC_MOTORS > 2
-#error "Max number of motors with WIFI_ENABLE is 5"
+    gpio_irq_init();
+  #if STEPPER_DDA_ENABLE
+    stepper_dda_init();
+  #endif
 #endif
 
-#ifdef X2_STEP_PIN
-    assign_step_sm(&z_step_pio, &x2_step_sm, X2_STEP_PIN);
-#endif
-#ifdef Y2_STEP_PIN
-    assign_step_sm(&z_step_pio, &y2_step_sm, Y2_STEP_PIN);
-#endif
-#ifdef Z2_STEP_PIN
-    assign_step_sm(&z_step_pio, &z2_step_sm, Z2_STEP_PIN);
-#endif
-#ifdef A_STEP_PIN
-    assign_step_sm(&z_step_pio, &a_step_sm, A_STEP_PIN);
-#endif
-#ifdef B_STEP_PIN
-    assign_step_sm(&z_step_pio, &b_step_sm, B_STEP_PIN);
-#endif
-#ifdef C_STEP_PIN
-    assign_step_sm(&z_step_pio, &c_step_sm, C_STEP_PIN);
-#endif
+#if STEP_PORT == GPIO_PIO_1
 
-#endif // N_ABC_MOTORS
+    assign_step_sms();
 
 #elif STEP_PORT == GPIO_PIO
 
+#if STEP_STREAM_ENABLE
+    stream.offset = pio_add_program(pio0, &step_stream_program); // State machine is started by driver_setup()
+#elif STEP_PULSE_AXIS_ENABLE
+    pio_offset = pio_add_program(pio0, &step_pulse_axis_program);
+    step_pulse_axis_program_init(pio0, 0, pio_offset, STEP_PINS_BASE, N_AXIS + N_GANGED, pio_clkdiv(STEP_TIMER_CLOCK));
+#else
     pio_offset = pio_add_program(pio0, &step_pulse_program);
-    step_pulse_program_init(pio0, 0, pio_offset, STEP_PINS_BASE, N_AXIS + N_GANGED);
+    step_pulse_program_init(pio0, 0, pio_offset, STEP_PINS_BASE, N_AXIS + N_GANGED, pio_clkdiv(STEP_TIMER_CLOCK));
+  #if STEP_GATE_ENABLE
+    step_gate.offset = pio_offset;
+  #endif
+#endif
     pio_sm_claim(pio0, 0);
 
 #elif STEP_PORT == GPIO_SR8
 
-    pio_offset = pio_add_program(pio0, &step_dir_sr4_program);
-    step_dir_sr4_program_init(pio0, 0, pio_offset, SD_SR_DATA_PIN, SD_SR_SCK_PIN);
+    pio_offset = step_dir_sr4_program_load(pio0, SD_SHIFT_REGISTER / 8);
+    step_dir_sr4_program_init(pio0, 0, pio_offset, SD_SR_DATA_PIN, SD_SR_SCK_PIN, max(1.0f, pio_clkdiv(SR_SHIFT_CLOCK)));
 
     pio_offset = pio_add_program(pio0, &sr_delay_program);
-    sr_delay_program_init(pio0, 1, pio_offset, 11.65f);
+    sr_delay_program_init(pio0, 1, pio_offset, pio_clkdiv(SR_DELAY_CLOCK));
 
     pio_offset = pio_add_program(pio0, &sr_hold_program);
-    sr_hold_program_init(pio0, 2, pio_offset, 11.65f);
+    sr_hold_program_init(pio0, 2, pio_offset, pio_clkdiv(SR_DELAY_CLOCK));
 
     pio_claim_sm_mask(pio0, 0b1111); // claim all state machines, no room for more programs
 
 #endif
 
 #if OUT_SHIFT_REGISTER
-    out_sr_sm = (uint32_t)(pio_claim_unused_sm(pio1, false));
+    out_sr_ctl.sm = (uint32_t)(pio_claim_unused_sm(pio1, false));
     pio_offset = pio_add_program(pio1, &out_sr16_program);
-    out_sr16_program_init(pio1, out_sr_sm, pio_offset, OUT_SR_DATA_PIN, OUT_SR_SCK_PIN);
+    out_sr16_program_init(pio1, out_sr_ctl.sm, pio_offset, OUT_SR_DATA_PIN, OUT_SR_SCK_PIN, max(1.0f, pio_clkdiv(SR_SHIFT_CLOCK)));
+    out_sr_ctl.ready = true; // Outputs changes made by board_init()
+    irq_set_pending(out_sr_ctl.irq);
+  #if OUT_SR_REFRESH_ENABLE
+    out_sr_refresh_init();
+  #endif
   #if SPI_RST_PORT == GPIO_SR16
     spi_reset_out(1);
   #endif
@@ -2805,6 +5337,74 @@ bool driver_init (void)
 
 #endif // NEOPIXELS_PIN
 
+#if PPI_ENABLE
+    {
+        int sm;
+        PIO pio = pio0;
+
+        if(!pio_can_add_program(pio, &one_shot_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+            pio = pio1;
+            if(!pio_can_add_program(pio, &one_shot_program) || (sm = pio_claim_unused_sm(pio, false)) == -1)
+                pio = NULL;
+        }
+
+        if(pio) {
+            ppi.pio = pio;
+            ppi.sm = (uint)sm;
+            one_shot_program_init(pio, ppi.sm, pio_add_program(pio, &one_shot_program), SPINDLE_ENABLE_PIN, pio_clkdiv(PPI_PIO_CLOCK));
+        } else
+            protocol_enqueue_foreground_task(report_plain, "PPI: no free PIO state machine");
+    }
+#endif
+
+#if PROBE_LATCH_ENABLE
+    if(!probe_latch_init())
+        protocol_enqueue_foreground_task(report_plain, "Probe latch: no free PIO state machines");
+#endif
+
+#if AXIS_ENCODER_ENABLE
+    axis_encoder_init(); // Claims state machines left over by the driver
+#endif
+
+#if SPINDLE_ENCODER_ENABLE
+    spindle_encoder_init();
+#endif
+
+#if SPINDLE_PID_ENABLE
+    spindle_pid_init(&spindle_pwm);
+#endif
+
+#if LASER_RASTER_ENABLE
+    laser_raster_init(&spindle_pwm);
+#endif
+
+#if LASER_VELOCITY_ENABLE
+    laser_velocity_init(&spindle_pwm, axis_step_pin);
+#endif
+
+#if STEP_FOLLOWER_ENABLE
+    step_follower_init();
+#endif
+
+    on_unknown_sys_command = grbl.on_unknown_sys_command;
+    grbl.on_unknown_sys_command = driver_sys_command;
+
+#if STEP_PULSE_AXIS_ENABLE
+    if((step_axis_nvs = nvs_alloc(sizeof(step_axis_settings_t))))
+        settings_register(&step_axis_setting_details);
+#endif
+
+#if LIMIT_LATCH_ENABLE
+    on_homing_completed = grbl.on_homing_completed;
+    grbl.on_homing_completed = onHomingCompleted;
+#endif
+
+#if STEP_GATE_ENABLE
+    step_gate_init();
+    on_realtime_report = grbl.on_realtime_report;
+    grbl.on_realtime_report = step_gate_realtime_report;
+#endif
+
 #include "grbl/plugins_init.h"
 
 #if WIFI_ENABLE || BLUETOOTH_ENABLE == 1
@@ -2823,9 +5423,24 @@ bool driver_init (void)
 // Main stepper driver
 void __not_in_flash_func(stepper_int_handler)(void)
 {
+#if STEPPER_TIMING_ENABLE
+    uint32_t entry = timing_get_cycles();
+
+    timing_enter(entry);
+#endif
+
     stepper_timer_irq_clear(pio1);
 
+#if STEP_INJECT_ENABLE
+    if(step_inject.drain)
+        stepperInjectDrain();
+    else
+#endif
     hal.stepper.interrupt_callback();
+
+#if STEPPER_TIMING_ENABLE
+    timing_exit(entry);
+#endif
 }
 
 // Limit debounce callback
@@ -2834,7 +5449,7 @@ static int64_t __not_in_flash_func(limit_debounce_callback)(alarm_id_t id, void
     if(((input_signal_t *)input)->debounce) {
 
         ((input_signal_t *)input)->debounce = false;
-        gpio_set_irq_enabled(((input_signal_t *)input)->pin, ((input_signal_t *)input)->invert ? GPIO_IRQ_EDGE_FALL : GPIO_IRQ_EDGE_RISE, true);
+        gpio_irq_enable(((input_signal_t *)input)->pin, ((input_signal_t *)input)->invert ? GPIO_IRQ_EDGE_FALL : GPIO_IRQ_EDGE_RISE, true);
 
         limit_signals_t state = limitsGetState();
         if(limit_signals_merge(state).value)
@@ -2848,27 +5463,47 @@ static int64_t __not_in_flash_func(limit_debounce_callback)(alarm_id_t id, void
 static int64_t __not_in_flash_func(srLatch_debounce_callback)(alarm_id_t id, void *input)
 {
     if(((input_signal_t *)input)->id == Input_Probe)
-        gpio_set_irq_enabled(((input_signal_t *)input)->pin, probe.inverted ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
+        gpio_irq_enable(((input_signal_t *)input)->pin, probe.inverted ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
     else if(((input_signal_t *)input)->id == Input_SafetyDoor)
-        gpio_set_irq_enabled(((input_signal_t *)input)->pin, ((input_signal_t *)input)->invert ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
+        gpio_irq_enable(((input_signal_t *)input)->pin, ((input_signal_t *)input)->invert ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
 
     return 0;
 }
 
-#if PPI_ENABLE
-
-// PPI timer interrupt handler
-void __not_in_flash_func(PPI_TIMER_IRQHandler)(void)
+// GPIO interrupt dispatcher, registered as a raw handler for the input pins to bypass the Pico library
+// dispatcher which runs from flash. Other raw handlers, e.g. for the cyw43 host wake pin, are left untouched.
+static void __not_in_flash_func(gpio_irq_handler)(void)
 {
-    PPI_TIMER->SR = ~TIM_SR_UIF; // clear UIF flag;
+    uint_fast8_t bank, gpio;
+    uint32_t status, events;
+    io_irq_ctrl_hw_t *irq_ctrl = get_core_num() ? &iobank0_hw->proc1_irq_ctrl : &iobank0_hw->proc0_irq_ctrl;
+
+    for(bank = 0; bank < count_of(irq_ctrl->ints); bank++) {
 
-    spindle_off();
+        status = irq_ctrl->ints[bank];
+
+        for(gpio = bank << 3; status; gpio++, status >>= 4) {
+            if((events = status & 0x0F) && (gpio_irq_mask & (1 << gpio))) {
+                iobank0_hw->intr[bank] = events << (4 * (gpio & 0x07));
+                gpio_int_handler(gpio, events);
+            }
+        }
+    }
 }
 
-#endif
+// Adds the GPIO interrupt dispatcher for the input pins to the calling core.
+static void gpio_irq_init (void)
+{
+    uint32_t i = sizeof(inputpin) / sizeof(input_signal_t);
+
+    do {
+        gpio_irq_mask |= 1 << inputpin[--i].pin;
+    } while(i);
+
+    gpio_add_raw_irq_handler_masked(gpio_irq_mask, gpio_irq_handler);
+}
 
 // GPIO Interrupt handler
-// TODO: bypass the Pico library interrupt handler.
 void __not_in_flash_func(gpio_int_handler)(uint gpio, uint32_t events)
 {
     input_signal_t *input = NULL;
@@ -2885,17 +5520,17 @@ void __not_in_flash_func(gpio_int_handler)(uint gpio, uint32_t events)
 
 #ifdef SAFETY_DOOR_BIT
             if(input->id == Input_SafetyDoor) {
-                gpio_set_irq_enabled(gpio, GPIO_IRQ_ALL, false);
+                gpio_irq_enable(gpio, GPIO_IRQ_ALL, false);
                 // If the input is active fire the control interrupt immediately and register an
                 // alarm to reenable the interrupt after a short delay. Only after this delay has
                 // expired can the safety door signal be set inactive. This is done to avoid stressing
                 // the main state-machine.
                 if((input->active = !!(events & GPIO_IRQ_LEVEL_HIGH) ^ input->invert)) {
                     hal.control.interrupt_callback(systemGetState());
-                    if (!add_alarm_in_ms(DEBOUNCE_DELAY, srLatch_debounce_callback, (void *)input, false))
-                        gpio_set_irq_enabled(gpio, GPIO_IRQ_LEVEL_HIGH, true); // Reenable the IRQ in case the alarm wasn't registered.
+                    if (!debounce_alarm_in_ms(DEBOUNCE_DELAY, srLatch_debounce_callback, (void *)input, false))
+                        gpio_irq_enable(gpio, GPIO_IRQ_LEVEL_HIGH, true); // Reenable the IRQ in case the alarm wasn't registered.
                 } else
-                    gpio_set_irq_enabled(gpio, !input->invert ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
+                    gpio_irq_enable(gpio, !input->invert ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true);
             } else
 #endif
                 hal.control.interrupt_callback(systemGetState());
@@ -2903,26 +5538,37 @@ void __not_in_flash_func(gpio_int_handler)(uint gpio, uint32_t events)
 
 #ifdef PROBE_PIN
         case PinGroup_Probe:
-            gpio_set_irq_enabled(gpio, GPIO_IRQ_ALL, false);
+            gpio_irq_enable(gpio, GPIO_IRQ_ALL, false);
             // If input is active set the probe signal active immediately and register an
             // alarm to reenable the interrupt after a short delay. Only after this delay has
             // expired can the probe signal be set inactive.
             if((probe.triggered = !!(events & GPIO_IRQ_LEVEL_HIGH) ^ probe.inverted)) {
-                if(!add_alarm_in_ms(DEBOUNCE_DELAY, srLatch_debounce_callback, (void *)input, false))
-                    gpio_set_irq_enabled(gpio, probe.inverted ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true); // Reenable the IRQ in case the alarm wasn't registered.
+#if PROBE_LATCH_ENABLE
+                probe_latch_freeze();
+#endif
+                if(!debounce_alarm_in_ms(DEBOUNCE_DELAY, srLatch_debounce_callback, (void *)input, false))
+                    gpio_irq_enable(gpio, probe.inverted ? GPIO_IRQ_LEVEL_HIGH : GPIO_IRQ_LEVEL_LOW, true); // Reenable the IRQ in case the alarm wasn't registered.
             } else
-                gpio_set_irq_enabled(gpio, probe.inverted ? GPIO_IRQ_LEVEL_LOW : GPIO_IRQ_LEVEL_HIGH, true);
+                gpio_irq_enable(gpio, probe.inverted ? GPIO_IRQ_LEVEL_LOW : GPIO_IRQ_LEVEL_HIGH, true);
             break;
 #endif
 
         case PinGroup_Limit:
         case PinGroup_LimitMax:
         {
+#if LIMIT_LATCH_ENABLE
+            // Homing switches are latched during homing, the homing cycle polls the switches.
+            uint_fast8_t idx = input - limit_inputs.pins.inputs;
+            if(limit_latch.armed & (1u << idx)) {
+                limit_latch_trip(idx);
+                break;
+            }
+#endif
             // If debounce is enabled register an alarm to reenable the IRQ after the debounce delay has expired.
             // If the input is still active when the delay expires the limits interrupt will be fired.
-            if(hal.driver_cap.software_debounce && add_alarm_in_ms(DEBOUNCE_DELAY, limit_debounce_callback, (void *)input, true)) {
+            if(hal.driver_cap.software_debounce && debounce_alarm_in_ms(DEBOUNCE_DELAY, limit_debounce_callback, (void *)input, true)) {
                 input->debounce = true;
-                gpio_set_irq_enabled(gpio, GPIO_IRQ_ALL, false); // Disable the pin IRQ for the duration of the debounce delay.
+                gpio_irq_enable(gpio, GPIO_IRQ_ALL, false); // Disable the pin IRQ for the duration of the debounce delay.
             } else
                 hal.limits.interrupt_callback(limitsGetState());
         }
@@ -2967,4 +5613,12 @@ void __not_in_flash_func(isr_systick)(void)
         fatfs_ticks = 10;
     }
 #endif
+
+#if SPINDLE_PID_ENABLE
+    static uint32_t pid_ticks = SPINDLE_PID_PERIOD;
+    if(!(--pid_ticks)) {
+        spindle_pid_update();
+        pid_ticks = SPINDLE_PID_PERIOD;
+    }
+#endif
 }
@@ -118,10 +118,6 @@
 #define RPM_TIMER_IRQn              timerINT(RPM_TIMER_N)
 #define RPM_TIMER_IRQHandler        timerHANDLER(RPM_TIMER_N)
 
-#define PPI_TIMER_N                 2
-#define PPI_TIMER                   timer(PPI_TIMER_N)
-#define PPI_TIMER_IRQn              timerINT(PPI_TIMER_N)
-#define PPI_TIMER_IRQHandler        timerHANDLER(PPI_TIMER_N)
 */
 
 #if WEBUI_ENABLE && LITTLEFS_ENABLE
@@ -151,6 +147,8 @@
   #include "my_machine_map.h"
 #elif defined(BOARD_GENERIC_4AXIS)
   #include "generic_map_4axis.h"
+#elif defined(BOARD_GENERIC_SR16)
+  #include "generic_sr16_map.h"
 #else // default board
   #include "generic_map.h"
 #endif
@@ -174,6 +172,22 @@
 #endif
 #endif
 
+#if LASER_RASTER_ENABLE
+// Max. number of pixels in a scanline, the default fits a $RASTER command in the line buffer.
+#ifndef LASER_RASTER_PIXELS
+#define LASER_RASTER_PIXELS 120
+#endif
+#endif
+
+// System clock set at boot, PIO dividers and peripheral clocks are derived from it.
+#ifndef SYS_CLOCK_KHZ
+#define SYS_CLOCK_KHZ 125000
+#endif
+
+#if SYS_CLOCK_KHZ < 48000 || SYS_CLOCK_KHZ > 266000
+#error "System clock must be in the range 48 - 266 MHz!"
+#endif
+
 // Adjust STEP_PULSE_LATENCY to get accurate step pulse length when required, e.g if using high step rates.
 // The default value is calibrated for 10 microseconds length.
 // NOTE: step output mode, number of axes and compiler optimization settings may all affect this value.
@@ -181,6 +195,60 @@
 #define STEP_PULSE_LATENCY 1.0f // microseconds
 #endif
 
+#if STEP_STREAM_ENABLE
+// Number of step timer ticks per DMA block. The core stepper interrupt is run up to two blocks ahead of the output.
+#ifndef STEP_STREAM_BLOCK
+#define STEP_STREAM_BLOCK 32
+#endif
+// Max. output time of a DMA block in microseconds, a block is ended early when its ticks add up to this.
+#ifndef STEP_STREAM_BLOCK_TIME
+#define STEP_STREAM_BLOCK_TIME 1000
+#endif
+#endif
+
+#if SPINDLE_PID_ENABLE
+// Spindle PID update period in milliseconds, RPM is measured over the last 8 periods.
+#ifndef SPINDLE_PID_PERIOD
+#define SPINDLE_PID_PERIOD 20
+#endif
+#endif
+
+#if STEP_FOLLOWER_ENABLE
+// Step follower poll period in microseconds, up to STEP_INJECT_QUEUE_SIZE - 1 steps are queued per period.
+// Input steps are output up to a poll period plus the time to output the queued steps late.
+#ifndef FOLLOWER_PERIOD
+#define FOLLOWER_PERIOD 100
+#endif
+#endif
+
+#if AXIS_ENCODER_ENABLE
+// Encoder following error limit, in steps. An alarm is raised or a warning is issued when exceeded.
+// When step streaming the limit is widened by the stream depth as the commanded position leads the output.
+#ifndef ENCODER_FOLLOWING_ERROR
+#define ENCODER_FOLLOWING_ERROR 50
+#endif
+// Steps per encoder count, the decoder counts both edges of the A channel - i.e. two counts per encoder line.
+// Set negative to reverse the encoder direction.
+#ifndef X_ENCODER_STEPS_PER_COUNT
+#define X_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#ifndef Y_ENCODER_STEPS_PER_COUNT
+#define Y_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#ifndef Z_ENCODER_STEPS_PER_COUNT
+#define Z_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#ifndef A_ENCODER_STEPS_PER_COUNT
+#define A_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#ifndef B_ENCODER_STEPS_PER_COUNT
+#define B_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#ifndef C_ENCODER_STEPS_PER_COUNT
+#define C_ENCODER_STEPS_PER_COUNT 1.0f
+#endif
+#endif
+
 // End configuration
 
 #if EEPROM_ENABLE == 0
@@ -273,6 +341,70 @@
 #define STEPPERS_DISABLE_PINMODE PINMODE_OUTPUT
 #endif
 
+#if LASER_RASTER_ENABLE && !(DRIVER_SPINDLE_PWM_ENABLE && defined(X_STEP_PIN))
+#error "Laser raster mode requires a PWM spindle and a GPIO or PIO X step output!"
+#endif
+
+#if LASER_VELOCITY_ENABLE && !(DRIVER_SPINDLE_PWM_ENABLE && STEP_PORT != GPIO_SR8)
+#error "Laser velocity power requires a PWM spindle and GPIO or PIO step outputs!"
+#endif
+
+#if LASER_VELOCITY_ENABLE && LASER_RASTER_ENABLE
+#error "Laser velocity power and raster mode cannot be enabled at the same time!"
+#endif
+
+#if SPINDLE_SYNC_ENABLE && !SPINDLE_ENCODER_ENABLE
+#error "Spindle synchronized motion requires the spindle encoder!"
+#endif
+
+#if SPINDLE_ENCODER_ENABLE && !(defined(SPINDLE_PULSE_PIN) && defined(SPINDLE_INDEX_PIN))
+#error "Spindle encoder is not supported by the selected board or no free aux inputs are available!"
+#endif
+
+#if SPINDLE_PID_ENABLE && !(DRIVER_SPINDLE_PWM_ENABLE && defined(SPINDLE_PULSE_PIN))
+#error "Spindle PID requires a PWM spindle and a spindle tach input!"
+#endif
+
+#if SPINDLE_PID_ENABLE && ((SPINDLE_PULSE_PIN & 1) == 0 || ((SPINDLE_PULSE_PIN >> 1) & 7) == ((SPINDLE_PWM_PIN >> 1) & 7))
+#error "Spindle tach input must be a PWM B pin of a PWM slice not used by the spindle!"
+#endif
+
+#if SPINDLE_PID_ENABLE && SPINDLE_ENCODER_ENABLE
+#error "Spindle PID and spindle encoder cannot be enabled at the same time!"
+#endif
+
+#if OUT_SR_REFRESH_ENABLE && !OUT_SHIFT_REGISTER
+#error "Output shift register refresh requires a board with an output shift register!"
+#endif
+
+#if STEP_GATE_ENABLE && !defined(STEP_GATE_PIN) && ESTOP_ENABLE && defined(RESET_PIN)
+#define STEP_GATE_PIN RESET_PIN // E-stop input
+#endif
+
+#if STEP_GATE_ENABLE && !defined(STEP_GATE_PIN)
+#error "Step gate requires an E-stop input or STEP_GATE_PIN set to a control or limit input!"
+#endif
+
+#if STEP_GATE_ENABLE && !((STEP_PORT == GPIO_PIO && !(STEP_STREAM_ENABLE || STEP_PULSE_AXIS_ENABLE)) || STEP_PORT == GPIO_PIO_1)
+#error "Step gate requires PIO step outputs, not available with step streaming or per axis step pulses!"
+#endif
+
+#if SYNC_OUTPUT_ENABLE && !STEP_STREAM_ENABLE
+#error "Step accurate synchronized outputs require step streaming, else they are set by the stepper interrupt at the block start tick!"
+#endif
+
+#if STEP_FOLLOWER_ENABLE && !STEP_INJECT_ENABLE
+#error "Step follower requires step injection!"
+#endif
+
+#if STEP_FOLLOWER_ENABLE && !(defined(FOLLOWER_STEP_PIN) && defined(FOLLOWER_DIR_PIN))
+#error "Step follower is not supported by the selected board or no free aux inputs are available!"
+#endif
+
+#if AXIS_ENCODER_ENABLE && !(defined(X_ENCODER_A_PIN) || defined(Y_ENCODER_A_PIN) || defined(Z_ENCODER_A_PIN) || defined(A_ENCODER_A_PIN) || defined(B_ENCODER_A_PIN) || defined(C_ENCODER_A_PIN))
+#error "Axis encoders are not supported by the selected board or no free aux inputs are available!"
+#endif
+
 typedef struct {
     pin_function_t id;
     pin_group_t group;
@@ -315,6 +447,11 @@ void board_init (pin_group_pins_t *aux_inputs, pin_group_pins_t *aux_outputs, ou
 #else
 void board_init (void);
 #endif
+#if OUT_SHIFT_REGISTER
+void out_sr_hold (void);
+void out_sr_update (void);
+void out_sr_release (void);
+#endif
 #if SPI_RST_PORT == GPIO_SR16
 void spi_reset_out (bool on);
 #endif
@@ -323,6 +460,42 @@ void ioports_init (pin_group_pins_t *aux_inputs, pin_group_pins_t *aux_outputs);
 void ioports_init_analog (pin_group_pins_t *aux_inputs, pin_group_pins_t *aux_outputs);
 void ioports_event (input_signal_t *input);
 void pinEnableIRQ (const input_signal_t *input, pin_irq_mode_t irq_mode);
+#if AXIS_ENCODER_ENABLE || SPINDLE_ENCODER_ENABLE || SPINDLE_PID_ENABLE || STEP_FOLLOWER_ENABLE
+bool aux_input_claim (uint8_t pin, const char *description);
+#endif
+#if AXIS_ENCODER_ENABLE
+void axis_encoder_init (void);
+#endif
+#if SPINDLE_ENCODER_ENABLE
+void spindle_encoder_init (void);
+#endif
+#if SPINDLE_PID_ENABLE
+void spindle_pid_init (spindle_pwm_t *pwm);
+void spindle_pid_update (void);
+void spindle_pid_set_rpm (float rpm);
+bool spindle_pid_at_speed (void);
+#endif
+#if LASER_RASTER_ENABLE
+void laser_raster_init (spindle_pwm_t *pwm);
+void laser_raster_stop (void);
+bool laser_raster_active (void);
+#endif
+#if STEPPER_CORE1_ENABLE
+bool stepper_active (void);
+#endif
+#if STEP_INJECT_ENABLE
+bool stepper_inject_step (axes_signals_t step_outbits, axes_signals_t dir_outbits, bool position);
+bool stepper_inject_pending (void);
+uint32_t stepper_inject_rate (void);
+#endif
+#if STEP_FOLLOWER_ENABLE
+void step_follower_init (void);
+#endif
+#if LASER_VELOCITY_ENABLE
+void laser_velocity_init (spindle_pwm_t *pwm, const uint8_t *step_pin);
+void laser_velocity_enable (bool on);
+bool laser_velocity_set_level (uint_fast16_t level);
+#endif
 
 /**
   \brief   Enable IRQ Interrupts
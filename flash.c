@@ -27,6 +27,9 @@
 	IMPORTANT! If both cores are in use synchronization has to be added since flash cannot be read during programming
 	
 	See 4.1.8. hardware_flash in the SDK documentation.
+
+	When STEPPER_CORE1_ENABLE is set core 1 is paused via the multicore lockout mechanism while flash is written.
+	Writes are refused while core 1 generates steps, the core keeps the settings dirty and retries the write later.
 */
 
 #include <string.h>
@@ -36,6 +39,10 @@
 
 #include "driver.h"
 
+#if STEPPER_CORE1_ENABLE
+#include "pico/multicore.h"
+#endif
+
 #define FLASH_TARGET_OFFSET (2016 * 1024) // Last 32K
 
 static const uint8_t *flash_target = (const uint8_t *)(XIP_BASE + FLASH_TARGET_OFFSET);    // Last page start adress
@@ -52,10 +59,23 @@ bool memcpy_to_flash (uint8_t *source)
     if (!memcmp(source, flash_target, hal.nvs.size))
         return true;
  
+#if STEPPER_CORE1_ENABLE
+    multicore_lockout_start_blocking();
+#endif
     __disable_irq();
+#if STEPPER_CORE1_ENABLE
+    if(stepper_active()) {
+        __enable_irq();
+        multicore_lockout_end_blocking();
+        return false;
+    }
+#endif
     flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE); // 4K
     flash_range_program(FLASH_TARGET_OFFSET, source, FLASH_PAGE_SIZE * (hal.nvs.size / FLASH_PAGE_SIZE + (hal.nvs.size % FLASH_PAGE_SIZE ? 1 :0)));
     __enable_irq();
+#if STEPPER_CORE1_ENABLE
+    multicore_lockout_end_blocking();
+#endif
  
     return !memcmp(source, flash_target, hal.nvs.size);
 }
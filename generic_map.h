@@ -105,6 +105,25 @@
 #define MOTOR_FAULT_PIN         AUXINPUT0_PIN
 #endif
 
+#if AXIS_ENCODER_ENABLE && !(SAFETY_DOOR_ENABLE || MOTOR_FAULT_ENABLE)
+#define X_ENCODER_A_PIN         AUXINPUT0_PIN
+#define X_ENCODER_B_PIN         AUXINPUT1_PIN
+#endif
+
+#if SPINDLE_ENCODER_ENABLE && !(AXIS_ENCODER_ENABLE || SAFETY_DOOR_ENABLE || MOTOR_FAULT_ENABLE)
+#define SPINDLE_PULSE_PIN       AUXINPUT0_PIN
+#define SPINDLE_INDEX_PIN       AUXINPUT1_PIN
+#endif
+
+#if SPINDLE_PID_ENABLE && !(SAFETY_DOOR_ENABLE || AXIS_ENCODER_ENABLE || SPINDLE_ENCODER_ENABLE)
+#define SPINDLE_PULSE_PIN       AUXINPUT1_PIN // PWM slice 2 B
+#endif
+
+#if STEP_FOLLOWER_ENABLE && !(SAFETY_DOOR_ENABLE || MOTOR_FAULT_ENABLE || AXIS_ENCODER_ENABLE || SPINDLE_ENCODER_ENABLE || SPINDLE_PID_ENABLE)
+#define FOLLOWER_STEP_PIN       AUXINPUT0_PIN
+#define FOLLOWER_DIR_PIN        AUXINPUT1_PIN
+#endif
+
 // Define probe switch input pin.
 #define PROBE_PIN               28
 
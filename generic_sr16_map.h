@@ -0,0 +1,176 @@
+/*
+  generic_sr16_map.h - driver code for RP2040 ARM processors
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Step and direction signals for up to 8 motors are output via two chained 74HC595 shift registers,
+// motor n step signal is output on QA + n of the second register and the direction signal on QA + n of the first.
+// Step and direction pins are bit numbers in the 16 bit register image.
+
+#include <stdint.h>
+
+#if TRINAMIC_ENABLE
+#error Trinamic plugin not supported!
+#endif
+
+#if N_ABC_MOTORS > 5
+#error "Axis configuration is not supported!"
+#endif
+
+typedef union {
+    uint16_t value;
+    struct {
+        uint16_t m7_step :1,
+                 m6_step :1,
+                 m5_step :1,
+                 m4_step :1,
+                 m3_step :1,
+                 z_step  :1,
+                 y_step  :1,
+                 x_step  :1,
+                 m7_dir  :1,
+                 m6_dir  :1,
+                 m5_dir  :1,
+                 m4_dir  :1,
+                 m3_dir  :1,
+                 z_dir   :1,
+                 y_dir   :1,
+                 x_dir   :1;
+    };
+} step_dir_t;
+
+typedef union {
+    uint32_t value;
+    struct {
+        step_dir_t set;
+        step_dir_t reset;
+    };
+} step_dir_sr_t;
+
+// Define step pulse and step direction output pins.
+#define SD_SHIFT_REGISTER       16
+#define SD_SR_DATA_PIN          2
+#define SD_SR_SCK_PIN           3 // includes next pin (4)
+
+#define STEP_PORT               GPIO_SR8
+#define DIRECTION_PORT          GPIO_SR8
+
+#define X_STEP_PIN              7
+#define Y_STEP_PIN              6
+#define Z_STEP_PIN              5
+#define X_DIRECTION_PIN         15
+#define Y_DIRECTION_PIN         14
+#define Z_DIRECTION_PIN         13
+
+// Define stepper driver enable/disable output pin.
+#define ENABLE_PORT             GPIO_OUTPUT
+#define STEPPERS_ENABLE_PIN     5
+
+// Define homing/hard limit switch input pins.
+#define X_LIMIT_PIN             6
+#define Y_LIMIT_PIN             7
+#define Z_LIMIT_PIN             8
+#define LIMIT_INMODE            GPIO_MAP
+
+// Define ganged axis or A, B and C axes step pulse and step direction output pins.
+#if N_ABC_MOTORS > 0
+#define M3_AVAILABLE
+#define M3_STEP_PIN             4
+#define M3_DIRECTION_PIN        12
+#define M3_LIMIT_PIN            9
+#endif
+
+#if N_ABC_MOTORS > 1
+#define M4_AVAILABLE
+#define M4_STEP_PIN             3
+#define M4_DIRECTION_PIN        11
+#define M4_LIMIT_PIN            10
+#endif
+
+#if N_ABC_MOTORS > 2
+#define M5_AVAILABLE
+#define M5_STEP_PIN             2
+#define M5_DIRECTION_PIN        10
+#define M5_LIMIT_PIN            11
+#endif
+
+#if N_ABC_MOTORS > 3
+#define M6_AVAILABLE
+#define M6_STEP_PIN             1
+#define M6_DIRECTION_PIN        9
+#define M6_LIMIT_PIN            12
+#endif
+
+#if N_ABC_MOTORS > 4
+#define M7_AVAILABLE
+#define M7_STEP_PIN             0
+#define M7_DIRECTION_PIN        8
+#define M7_LIMIT_PIN            13
+#endif
+
+// Define driver spindle pins
+
+#if DRIVER_SPINDLE_PWM_ENABLE
+#define SPINDLE_PWM_PORT        GPIO_OUTPUT
+#define SPINDLE_PWM_PIN         15
+#else
+#define AUXOUTPUT0_PORT         GPIO_OUTPUT
+#define AUXOUTPUT0_PIN          15
+#endif
+
+#if DRIVER_SPINDLE_DIR_ENABLE
+#define SPINDLE_PORT            GPIO_OUTPUT
+#define SPINDLE_DIRECTION_PIN   27
+#else
+#define AUXOUTPUT1_PORT         GPIO_OUTPUT
+#define AUXOUTPUT1_PIN          27
+#endif
+
+#if DRIVER_SPINDLE_ENABLE
+#ifndef SPINDLE_PORT
+#define SPINDLE_PORT            GPIO_OUTPUT
+#endif
+#define SPINDLE_ENABLE_PIN      26
+#else
+#define AUXOUTPUT2_PORT         GPIO_OUTPUT
+#define AUXOUTPUT2_PIN          26
+#endif
+
+#define AUXINPUT0_PIN           21
+
+// Define flood and mist coolant enable output pins.
+#define COOLANT_PORT            GPIO_OUTPUT
+#define COOLANT_FLOOD_PIN       16
+#define COOLANT_MIST_PIN        17
+
+// Define user-control controls (cycle start, reset, feed hold) input pins.
+#define RESET_PIN               18
+#define FEED_HOLD_PIN           19
+#define CYCLE_START_PIN         20
+
+#if SAFETY_DOOR_ENABLE
+#define SAFETY_DOOR_PIN         AUXINPUT0_PIN
+#elif MOTOR_FAULT_ENABLE
+#define MOTOR_FAULT_PIN         AUXINPUT0_PIN
+#endif
+
+// Define probe switch input pin.
+#define PROBE_PIN               22
+
+#if I2C_STROBE_ENABLE
+#define I2C_STROBE_PIN          28
+#endif
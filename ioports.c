@@ -144,7 +144,7 @@ static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_mode_t wai
     return value;
 }
 
-void ioports_event (input_signal_t *input)
+void __not_in_flash_func(ioports_event)(input_signal_t *input)
 {
     spin_lock = true;
     event_bits |= input->bit;
@@ -26,6 +26,7 @@
 #include "hardware/clocks.h"
 #include "hardware/adc.h"
 
+#include "pwm_divider.h"
 #include "grbl/ioports.h"
 
 #define ADC_TO_GPIO_SHIFT 26            // GPIO26 is ADC0
@@ -75,12 +76,13 @@ static bool init_pwm (xbar_t *output, pwm_config_t *config)
 {
     bool ok;
     ioports_pwm_t *pwm_data = (ioports_pwm_t *)output->port;
-    uint32_t prescaler = config->freq_hz > 2000.0f ? 1 : (config->freq_hz > 200.0f ? 12 : 50);
+    pwm_divider_t div;
 
-    if((ok = ioports_precompute_pwm_values(config, pwm_data, clock_get_hz(clk_sys) / prescaler))) {
+    if((ok = pwm_divider_solve(clock_get_hz(clk_sys), config->freq_hz, &div) &&
+              ioports_precompute_pwm_values(config, pwm_data, div.clock_hz))) {
 
         pwm_config pwm_config = pwm_get_default_config();
-        pwm_config_set_clkdiv_int(&pwm_config, prescaler);
+        pwm_config_set_clkdiv_int_frac(&pwm_config, div.div16 >> 4, div.div16 & 0x0F);
         pwm_config_set_wrap(&pwm_config, pwm_data->period);
 
         gpio_set_function(output->pin, GPIO_FUNC_PWM);
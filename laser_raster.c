@@ -0,0 +1,316 @@
+/*
+  laser_raster.c - DMA driven raster engraving, spindle PWM levels paced by X axis step pulses
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if LASER_RASTER_ENABLE
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/time.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/pwm.h"
+#include "hardware/structs/iobank0.h"
+
+#include "driverPIO.pio.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/report.h"
+
+#define RASTER_TEST_PIXELS 64
+#define RASTER_TEST_STEPS  3
+
+// A scanline is a list of spindle PWM compare register values, one per pixel followed by one for laser off.
+// The step_pacer state machine counts X axis step pulses, it is fed the list by one DMA channel and
+// hands each value over to a second DMA channel that writes it to the compare register of the spindle PWM slice.
+// The first pixel is output on the first step pulse after the scanline is armed, the next after steps per pixel
+// pulses and so on. Laser off is output on the first step pulse after the last pixel, scanline moves should
+// include overscan.
+// NOTE: the compare register holds the levels of both channels of the PWM slice, the level of the channel not
+// used by the spindle is captured when the scanline is armed.
+static struct {
+    PIO pio;
+    uint sm;
+    uint offset;
+    uint dma_tx;
+    uint dma_rx;
+    uint slice;
+    uint32_t shift;     // Level shift in the compare register, 16 for channel B
+    uint32_t words;     // Number of words in the armed scanline
+    volatile bool armed;
+    spindle_pwm_t *pwm;
+    uint32_t level[LASER_RASTER_PIXELS + 1];
+} raster = {0};
+
+static on_unknown_sys_command_ptr on_unknown_sys_command;
+
+static inline void step_pin_inover (uint32_t override)
+{
+    hw_write_masked(&iobank0_hw->io[X_STEP_PIN].ctrl, override << IO_BANK0_GPIO0_CTRL_INOVER_LSB, IO_BANK0_GPIO0_CTRL_INOVER_BITS);
+}
+
+// Stops scanline output, called on spindle off.
+// The caller is responsible for setting the compare register to the off level.
+void __not_in_flash_func(laser_raster_stop)(void)
+{
+    if(raster.armed) {
+        raster.armed = false;
+        pio_sm_set_enabled(raster.pio, raster.sm, false);
+        dma_channel_abort(raster.dma_tx);
+        dma_channel_abort(raster.dma_rx);
+        step_pin_inover(GPIO_OVERRIDE_NORMAL);
+    }
+}
+
+// Returns true while a scanline is being output, the spindle PWM update must then leave the compare register alone.
+bool __not_in_flash_func(laser_raster_active)(void)
+{
+    return raster.armed && dma_channel_is_busy(raster.dma_rx);
+}
+
+static uint32_t raster_pixels_done (void)
+{
+    return raster.armed ? raster.words - dma_channel_hw_addr(raster.dma_rx)->transfer_count : 0;
+}
+
+// Maps a pixel value, 0 - 255, to a compare register value for the spindle PWM channel. 0 is laser off.
+static uint32_t pixel_level (uint8_t value)
+{
+    uint32_t level;
+
+    if(value == 0)
+        level = raster.pwm->always_on ? raster.pwm->off_value : 0;
+    else
+        level = raster.pwm->min_value + ((uint32_t)(raster.pwm->max_value - raster.pwm->min_value) * value + 127) / 255;
+
+    return level << raster.shift;
+}
+
+// Loads a scanline, a laser off level is appended.
+static void raster_load (const uint8_t *pixels, uint32_t n_pixels)
+{
+    uint_fast16_t idx;
+
+    for(idx = 0; idx < n_pixels; idx++)
+        raster.level[idx] = pixel_level(pixels[idx]);
+
+    raster.level[n_pixels] = pixel_level(0);
+    raster.words = n_pixels + 1;
+}
+
+// Arms the loaded scanline, levels are written to dest - the PWM compare register or a buffer when testing.
+static void raster_arm (uint32_t steps_per_pixel, volatile void *dest, bool write_increment)
+{
+    uint_fast16_t idx;
+    uint32_t other = pwm_hw->slice[raster.slice].cc & ~(0xFFFFu << raster.shift);
+    dma_channel_config config;
+
+    laser_raster_stop();
+
+    for(idx = 0; idx < raster.words; idx++)
+        raster.level[idx] = (raster.level[idx] & (0xFFFFu << raster.shift)) | other;
+
+    step_pacer_restart(raster.pio, raster.sm, raster.offset, steps_per_pixel);
+    // Invert the input of an inverted step signal so the state machine sees active high step pulses.
+    step_pin_inover(settings.steppers.step_invert.x ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+
+    config = dma_channel_get_default_config(raster.dma_rx);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, write_increment);
+    channel_config_set_dreq(&config, pio_get_dreq(raster.pio, raster.sm, false));
+    dma_channel_configure(raster.dma_rx, &config, dest, &raster.pio->rxf[raster.sm], raster.words, true);
+
+    config = dma_channel_get_default_config(raster.dma_tx);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(raster.pio, raster.sm, true));
+    dma_channel_configure(raster.dma_tx, &config, &raster.pio->txf[raster.sm], raster.level, raster.words, true);
+
+    raster.armed = true;
+    pio_sm_set_enabled(raster.pio, raster.sm, true);
+}
+
+static int8_t hex_digit (char c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : (c >= 'A' && c <= 'F' ? c - 'A' + 10 : (c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1));
+}
+
+// $RASTER=<steps per pixel>,<pixels> - waits for motion to complete and arms a scanline for the next X axis motion.
+// Pixels are two hex digits each, 00 is laser off and 01 - FF are mapped to the spindle PWM range.
+static status_code_t raster_load_command (sys_state_t state, char *args)
+{
+    char *end;
+    int8_t hi, lo;
+    uint32_t steps_per_pixel, n_pixels = 0;
+    uint8_t pixels[LASER_RASTER_PIXELS];
+
+    if(!(state == STATE_IDLE || state == STATE_CYCLE))
+        return Status_IdleError;
+
+    steps_per_pixel = strtoul(args, &end, 10);
+
+    if(end == args || *end != ',' || steps_per_pixel == 0)
+        return Status_InvalidStatement;
+
+    args = end + 1;
+
+    while(*args) {
+        if((hi = hex_digit(*args++)) < 0 || (lo = hex_digit(*args++)) < 0)
+            return Status_BadNumberFormat;
+        if(n_pixels == LASER_RASTER_PIXELS)
+            return Status_Overflow;
+        pixels[n_pixels++] = (uint8_t)((hi << 4) | lo);
+    }
+
+    if(n_pixels == 0)
+        return Status_InvalidStatement;
+
+    // The step pacer counts all X steps, the scanline must not be armed until preceding motion is completed.
+    protocol_buffer_synchronize();
+
+    if(state_get() != STATE_IDLE)
+        return Status_IdleError;
+
+    raster_load(pixels, n_pixels);
+    raster_arm(steps_per_pixel, &pwm_hw->slice[raster.slice].cc, false);
+
+    return Status_OK;
+}
+
+// $RASTERTEST - outputs a synthetic scanline to a buffer, with step pulses simulated by overriding the X step pin input.
+// Checks the number of levels output after each pulse and the level sequence output.
+static status_code_t raster_selftest (sys_state_t state)
+{
+    static uint32_t capture[RASTER_TEST_PIXELS + 1];
+
+    uint_fast16_t idx;
+    uint32_t step, errors = 0;
+    uint8_t pixels[RASTER_TEST_PIXELS];
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    if(laser_raster_active())
+        return Status_InvalidStatement;
+
+    // Ramp from 3 to 255 with every eighth pixel off
+    for(idx = 0; idx < RASTER_TEST_PIXELS; idx++)
+        pixels[idx] = idx % 8 ? idx * 4 + 3 : 0;
+
+    memset(capture, 0, sizeof(capture));
+    raster_load(pixels, RASTER_TEST_PIXELS);
+    raster_arm(RASTER_TEST_STEPS, capture, true);
+
+    step_pin_inover(GPIO_OVERRIDE_LOW);
+    busy_wait_us(2);
+
+    for(step = 1; step <= RASTER_TEST_PIXELS * RASTER_TEST_STEPS + 1; step++) {
+        step_pin_inover(GPIO_OVERRIDE_HIGH);
+        busy_wait_us(2);
+        step_pin_inover(GPIO_OVERRIDE_LOW);
+        busy_wait_us(2);
+        if(raster_pixels_done() != (step - 1) / RASTER_TEST_STEPS + 1)
+            errors++;
+    }
+
+    for(idx = 0; idx <= RASTER_TEST_PIXELS; idx++) {
+        if(capture[idx] != raster.level[idx])
+            errors++;
+    }
+
+    if(((capture[RASTER_TEST_PIXELS - 1] >> raster.shift) & 0xFFFF) != raster.pwm->max_value ||
+        ((capture[RASTER_TEST_PIXELS] >> raster.shift) & 0xFFFF) != (raster.pwm->always_on ? raster.pwm->off_value : 0))
+        errors++;
+
+    laser_raster_stop();
+    raster.words = 0;
+
+    hal.stream.write("[RASTERTEST:");
+    hal.stream.write(errors ? "FAIL," : "OK,");
+    hal.stream.write(uitoa(errors));
+    hal.stream.write("]" ASCII_EOL);
+
+    return errors ? Status_SelfTestFailed : Status_OK;
+}
+
+static status_code_t raster_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_Unhandled;
+
+    if(!strcmp(line, "$RASTER")) {
+        hal.stream.write("[RASTER:");
+        hal.stream.write(uitoa(raster.words ? min(raster_pixels_done(), raster.words - 1) : 0));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(raster.words ? raster.words - 1 : 0));
+        hal.stream.write("]" ASCII_EOL);
+        retval = Status_OK;
+    } else if(!strcmp(line, "$RASTERTEST"))
+        retval = raster_selftest(state);
+    else if(!strncmp(line, "$RASTER=", 8))
+        retval = raster_load_command(state, line + 8);
+
+    if(retval == Status_Unhandled && on_unknown_sys_command)
+        retval = on_unknown_sys_command(state, line);
+
+    return retval;
+}
+
+// Called from driver_init() after the driver state machines are claimed.
+void laser_raster_init (spindle_pwm_t *pwm)
+{
+    int sm, dma_tx, dma_rx;
+    PIO pio = pio0;
+
+    if(!pio_can_add_program(pio, &step_pacer_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+        pio = pio1;
+        if(!pio_can_add_program(pio, &step_pacer_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+            protocol_enqueue_foreground_task(report_plain, "Laser raster: no free PIO state machine");
+            return;
+        }
+    }
+
+    if((dma_tx = dma_claim_unused_channel(false)) == -1 || (dma_rx = dma_claim_unused_channel(false)) == -1) {
+        if(dma_tx != -1)
+            dma_channel_unclaim(dma_tx);
+        pio_sm_unclaim(pio, sm);
+        protocol_enqueue_foreground_task(report_plain, "Laser raster: no free DMA channels");
+        return;
+    }
+
+    raster.pio = pio;
+    raster.sm = (uint)sm;
+    raster.offset = pio_add_program(pio, &step_pacer_program);
+    raster.dma_tx = (uint)dma_tx;
+    raster.dma_rx = (uint)dma_rx;
+    raster.pwm = pwm;
+    raster.slice = pwm_gpio_to_slice_num(SPINDLE_PWM_PIN);
+    raster.shift = pwm_gpio_to_channel(SPINDLE_PWM_PIN) == PWM_CHAN_B ? 16 : 0;
+
+    step_pacer_program_init(pio, raster.sm, raster.offset, X_STEP_PIN);
+
+    on_unknown_sys_command = grbl.on_unknown_sys_command;
+    grbl.on_unknown_sys_command = raster_command;
+}
+
+#endif // LASER_RASTER_ENABLE
@@ -0,0 +1,280 @@
+/*
+  laser_velocity.c - velocity proportional laser power from a PIO step rate measurement and a DMA lookup table
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if LASER_VELOCITY_ENABLE
+
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/pwm.h"
+#include "hardware/clocks.h"
+
+#include "driverPIO.pio.h"
+#include "grbl/protocol.h"
+#include "grbl/report.h"
+#include "grbl/nvs_buffer.h"
+
+#define RATE_NOMINAL 32 // Period in step_rate units at the programmed feed rate
+
+#ifndef LASER_VELOCITY_SETTING
+#define LASER_VELOCITY_SETTING Setting_UserDefined_0
+#endif
+
+// The step_rate state machine measures the step period of the dominant axis of the executing block and pushes the
+// address of the matching entry in a table of spindle PWM compare register values. One DMA channel writes the address
+// to the read address trigger register of a second channel that copies the entry to the compare register.
+// The state machine clock is set per block so that the programmed feed rate is RATE_NOMINAL units, the table is
+// rebuilt when the laser power changes. Power is scaled down from 1 to 1/8 of the set power as velocity drops from
+// the programmed rate to 1/8 of it and is kept at 1/8 at lower velocities.
+// NOTE: the compare register holds the levels of both channels of the PWM slice, the level of the channel not
+// used by the spindle is captured when the table is built.
+// Scaling is opt-in by setting as it changes M3 from constant to velocity dependent power. It is not applied in M4
+// as the core already scales the power of M4 motion by segment velocity.
+static struct {
+    PIO pio;
+    uint sm;
+    uint dma_addr;
+    uint dma_lut;
+    uint slice;
+    uint32_t shift;         // Level shift in the compare register, 16 for channel B
+    float clk_div_q8;       // 240 * system clock, divided by programmed rate * steps/mm gives the clock divider in 16.8 format
+    volatile bool enabled;  // Spindle on in laser mode, M3, and enabled by setting
+    volatile bool running;  // State machine and DMA running
+    uint_fast16_t level;    // Laser power the table is built for
+    const uint8_t *step_pin;
+    spindle_pwm_t *pwm;
+    stepper_pulse_start_ptr pulse_start;
+    uint16_t ratio[256];    // Velocity ratio per table entry, 1.15 fixed point
+} vel = {0};
+
+typedef struct {
+    bool enable;            // Scale M3 laser power with velocity
+} laser_velocity_settings_t;
+
+static nvs_address_t nvs_address;
+static laser_velocity_settings_t vel_settings;
+
+static uint32_t table[256] __attribute__((aligned(1024)));
+
+static void __not_in_flash_func(build_table)(uint_fast16_t level)
+{
+    uint_fast16_t idx = 256;
+    uint32_t other = pwm_hw->slice[vel.slice].cc & ~(0xFFFFu << vel.shift),
+             span = level > vel.pwm->min_value ? level - vel.pwm->min_value : 0,
+             min = level > vel.pwm->min_value ? vel.pwm->min_value : level;
+
+    do {
+        idx--;
+        table[idx] = ((min + ((span * vel.ratio[idx]) >> 15)) << vel.shift) | other;
+    } while(idx);
+
+    vel.level = level;
+}
+
+static void __not_in_flash_func(velocity_stop)(void)
+{
+    if(vel.running) {
+        vel.running = false;
+        pio_sm_set_enabled(vel.pio, vel.sm, false);
+        dma_channel_abort(vel.dma_addr);
+        dma_channel_abort(vel.dma_lut);
+    }
+}
+
+static void __not_in_flash_func(velocity_start)(void)
+{
+    if(!vel.running) {
+        vel.running = true;
+        pio_sm_clear_fifos(vel.pio, vel.sm);
+        // Start from the lowest velocity, the first measured period is from before the restart.
+        pwm_hw->slice[vel.slice].cc = table[0];
+        dma_channel_set_trans_count(vel.dma_addr, 0xFFFFFFFF, true);
+        pio_sm_set_enabled(vel.pio, vel.sm, true);
+    }
+}
+
+// Called from the spindle PWM update when the spindle is on, returns true if the level is handled by the lookup table.
+// Laser off, e.g. for rapids, stops the state machine and is left to the caller.
+bool __not_in_flash_func(laser_velocity_set_level)(uint_fast16_t level)
+{
+    if(!vel.enabled)
+        return false;
+
+    if(level == vel.pwm->off_value || level == 0) {
+        velocity_stop();
+        return false;
+    }
+
+    // Entries are replaced one by one, the table may be output while being rebuilt.
+    if(level != vel.level)
+        build_table(level);
+
+    velocity_start();
+
+    return true;
+}
+
+// Called on spindle state changes before the PWM level is set, velocity scaling is enabled for M3 in laser mode
+// when enabled by setting.
+void __not_in_flash_func(laser_velocity_enable)(bool on)
+{
+    if(vel.pio == NULL)
+        return;
+
+    if(!(vel.enabled = on && settings.mode == Mode_Laser && vel_settings.enable)) {
+        velocity_stop();
+        vel.level = 0; // Rebuild the table on next use, the PWM settings may have changed
+    }
+}
+
+// Selects the dominant axis and sets the state machine clock from the programmed rate for new blocks.
+static void __not_in_flash_func(laserVelocityPulseStart)(stepper_t *stepper)
+{
+    if(stepper->new_block && vel.enabled) {
+
+        uint_fast8_t idx = N_AXIS;
+        uint32_t div;
+
+        do {
+            if(stepper->exec_block->steps[--idx] == stepper->exec_block->step_event_count) {
+                step_rate_set_pin(vel.pio, vel.sm, vel.step_pin[idx]);
+                break;
+            }
+        } while(idx);
+
+        div = stepper->exec_block->programmed_rate > 0.0f
+               ? (uint32_t)(vel.clk_div_q8 / (stepper->exec_block->programmed_rate * stepper->exec_block->steps_per_mm))
+               : 0xFFFFFF;
+        vel.pio->sm[vel.sm].clkdiv = (div < 0x100 ? 0x100 : (div > 0xFFFFFF ? 0xFFFFFF : div)) << PIO_SM0_CLKDIV_FRAC_LSB;
+    }
+
+    vel.pulse_start(stepper);
+}
+
+static const setting_detail_t laser_velocity_setting_detail[] = {
+    { LASER_VELOCITY_SETTING, Group_Spindle, "Laser M3 velocity power", NULL, Format_Bool, NULL, NULL, NULL, Setting_NonCore, &vel_settings.enable, NULL, NULL }
+};
+
+#ifndef NO_SETTINGS_DESCRIPTIONS
+
+static const setting_descr_t laser_velocity_setting_descr[] = {
+    { LASER_VELOCITY_SETTING, "Scale laser power in M3 with the actual velocity in hardware, as M4 does per segment.\\n"
+                              "Off keeps M3 at constant power."
+    }
+};
+
+#endif
+
+static void laser_velocity_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&vel_settings, sizeof(laser_velocity_settings_t), true);
+}
+
+static void laser_velocity_settings_restore (void)
+{
+    vel_settings.enable = false;
+
+    laser_velocity_settings_save();
+}
+
+static void laser_velocity_settings_load (void)
+{
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&vel_settings, nvs_address, sizeof(laser_velocity_settings_t), true) != NVS_TransferResult_OK)
+        laser_velocity_settings_restore();
+}
+
+static setting_details_t laser_velocity_setting_details = {
+    .settings = laser_velocity_setting_detail,
+    .n_settings = sizeof(laser_velocity_setting_detail) / sizeof(setting_detail_t),
+#ifndef NO_SETTINGS_DESCRIPTIONS
+    .descriptions = laser_velocity_setting_descr,
+    .n_descriptions = sizeof(laser_velocity_setting_descr) / sizeof(setting_descr_t),
+#endif
+    .save = laser_velocity_settings_save,
+    .load = laser_velocity_settings_load,
+    .restore = laser_velocity_settings_restore
+};
+
+// Called from driver_init() after the driver state machines are claimed.
+// step_pin is the primary motor step pin per axis.
+void laser_velocity_init (spindle_pwm_t *pwm, const uint8_t *step_pin)
+{
+    int sm, dma_addr, dma_lut;
+    uint_fast16_t idx;
+    PIO pio = pio0;
+    dma_channel_config config;
+
+    if(!pio_can_add_program(pio, &step_rate_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+        pio = pio1;
+        if(!pio_can_add_program(pio, &step_rate_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+            protocol_enqueue_foreground_task(report_plain, "Laser velocity power: no free PIO state machine");
+            return;
+        }
+    }
+
+    if((dma_addr = dma_claim_unused_channel(false)) == -1 || (dma_lut = dma_claim_unused_channel(false)) == -1) {
+        if(dma_addr != -1)
+            dma_channel_unclaim(dma_addr);
+        pio_sm_unclaim(pio, sm);
+        protocol_enqueue_foreground_task(report_plain, "Laser velocity power: no free DMA channels");
+        return;
+    }
+
+    vel.pio = pio;
+    vel.sm = (uint)sm;
+    vel.dma_addr = (uint)dma_addr;
+    vel.dma_lut = (uint)dma_lut;
+    vel.pwm = pwm;
+    vel.step_pin = step_pin;
+    vel.slice = pwm_gpio_to_slice_num(SPINDLE_PWM_PIN);
+    vel.shift = pwm_gpio_to_channel(SPINDLE_PWM_PIN) == PWM_CHAN_B ? 16 : 0;
+    // Unit is two PIO cycles: divider = 60 / (rate * steps/mm) * clk_sys / (2 * RATE_NOMINAL), times 256 for 16.8 format
+    vel.clk_div_q8 = 60.0f * 256.0f / (2.0f * RATE_NOMINAL) * (float)clock_get_hz(clk_sys);
+
+    for(idx = 0; idx < 256; idx++) {
+        uint32_t period = 255 - idx;
+        vel.ratio[idx] = period <= RATE_NOMINAL ? 0x8000 : (RATE_NOMINAL * 0x8000 + period / 2) / period;
+    }
+
+    step_rate_program_init(pio, vel.sm, pio_add_program(pio, &step_rate_program), step_pin[X_AXIS], table);
+
+    // Table entry to compare register, triggered by a write to the read address
+    config = dma_channel_get_default_config(vel.dma_lut);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, false);
+    dma_channel_configure(vel.dma_lut, &config, &pwm_hw->slice[vel.slice].cc, table, 1, false);
+
+    // Table entry address from the state machine to the read address trigger register
+    config = dma_channel_get_default_config(vel.dma_addr);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio, vel.sm, false));
+    dma_channel_configure(vel.dma_addr, &config, &dma_hw->ch[vel.dma_lut].al3_read_addr_trig, &pio->rxf[vel.sm], 0xFFFFFFFF, false);
+
+    vel.pulse_start = hal.stepper.pulse_start;
+    hal.stepper.pulse_start = laserVelocityPulseStart;
+
+    if((nvs_address = nvs_alloc(sizeof(laser_velocity_settings_t))))
+        settings_register(&laser_velocity_setting_details);
+}
+
+#endif // LASER_VELOCITY_ENABLE
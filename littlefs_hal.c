@@ -17,8 +17,21 @@
 #include "hardware/sync.h"
 #include "pico/mutex.h"
 
+#include "driver.h"
 #include "littlefs_hal.h"
 
+// Core 1 is paused while flash is written, writes are refused with an I/O error while it generates steps.
+#if STEPPER_CORE1_ENABLE
+#include "pico/multicore.h"
+#define flash_lockout_start() multicore_lockout_start_blocking()
+#define flash_lockout_end() multicore_lockout_end_blocking()
+#define flash_write_allowed() !stepper_active()
+#else
+#define flash_lockout_start()
+#define flash_lockout_end()
+#define flash_write_allowed() true
+#endif
+
 #define FS_SIZE (512 * 1024)
 
 typedef struct {
@@ -46,11 +59,15 @@ static int pico_hal_prog (const struct lfs_config *c, lfs_block_t block, lfs_off
     assert(block < c->block_count);
     // program with SDK
     uint32_t p = (uint32_t)((pico_lfs_context_t *)c->context)->baseaddr + (block * c->block_size) + off;
+    flash_lockout_start();
     uint32_t ints = save_and_disable_interrupts();
-    flash_range_program(p, buffer, size);
+    bool ok = flash_write_allowed();
+    if(ok)
+        flash_range_program(p, buffer, size);
     restore_interrupts(ints);
+    flash_lockout_end();
 
-    return LFS_ERR_OK;
+    return ok ? LFS_ERR_OK : LFS_ERR_IO;
 }
 
 static int pico_hal_erase (const struct lfs_config *c, lfs_block_t block)
@@ -58,11 +75,15 @@ static int pico_hal_erase (const struct lfs_config *c, lfs_block_t block)
     assert(block < c->block_count);
     // erase with SDK
     uint32_t p = (uint32_t)((pico_lfs_context_t *)c->context)->baseaddr + block * c->block_size;
+    flash_lockout_start();
     uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(p, c->block_size);
+    bool ok = flash_write_allowed();
+    if(ok)
+        flash_range_erase(p, c->block_size);
     restore_interrupts(ints);
+    flash_lockout_end();
 
-    return LFS_ERR_OK;
+    return ok ? LFS_ERR_OK : LFS_ERR_IO;
 }
 
 static int pico_hal_sync (const struct lfs_config *c)
@@ -30,6 +30,7 @@
 //#define BOARD_CNC_BOOSTERPACK
 //#define BOARD_CITOH_CX6000    // C.ITOH CX-6000 HPGL plotter
 //#define BOARD_GENERIC_4AXIS
+//#define BOARD_GENERIC_SR16    // Step and direction signals for up to 8 motors via two chained shift registers
 //#define BOARD_MY_MACHINE      // Add my_machine_map.h before enabling this!
 
 // Configuration
@@ -80,6 +81,51 @@
 //#define EEPROM_IS_FRAM          1 // Uncomment when EEPROM is enabled and chip is FRAM, this to remove write delay.
 
 #define PLASMA_ENABLE           1 // Plasma plugin with THC
+//#define STEPPER_CORE1_ENABLE    1 // Run the stepper, limit, probe and control signal interrupts on core 1.
+                                    // Keeps step timing isolated from USB, networking and file system activity on core 0.
+                                    // Core 1 is paused while flash is written, so settings and littlefs writes are refused while
+                                    // steps are generated. Settings are written when motion has stopped, file writes fail.
+//#define STEP_STREAM_ENABLE      1 // Stream step and direction signals to the PIO via DMA, the stepper interrupt is run once per block of
+                                    // STEP_STREAM_BLOCK (default 32) steps or STEP_STREAM_BLOCK_TIME (default 1000) microseconds of output.
+                                    // Requires PIO step outputs and GPIO direction outputs, and PROBE_LATCH_ENABLE if a probe input is used.
+//#define STEPPER_TIMING_ENABLE   1 // Measure stepper interrupt latency and execution time, report with $STEPTIME and reset with $STEPTIME=R.
+//#define STEP_SELFTEST_ENABLE    1 // Step output self-test, $STEPTEST measures step pulse width, dir to step setup time and step skew,
+                                    // $STEPTEST=C also corrects the pulse timing. Requires PIO step outputs and GPIO direction outputs.
+//#define AXIS_ENCODER_ENABLE     1 // Quadrature encoder following error check, 1 = alarm, 2 = warning only. Encoder inputs are assigned
+                                    // from the aux inputs by the board map, $ENCODERS reports position and following error.
+//#define PROBE_LATCH_ENABLE      1 // Latch the probe position from PIO step counters stopped by the probe input, for accurate
+                                    // probing at higher feed rates. Requires one spare PIO state machine per axis and GPIO direction outputs.
+//#define PWM_SELFTEST_ENABLE     1 // PWM divider self-test, $PWMTEST checks the divider and wrap selected over the full frequency range.
+                                    // Blocks the protocol loop while running, only accepted in idle state.
+//#define STEPPER_DDA_ENABLE      1 // Interpolator based DDA (Bresenham) step generation helpers for the stepper interrupt core,
+                                    // $STEPDDA benchmarks them against the plain C loop.
+//#define STEP_LUT_BENCHMARK_ENABLE 1 // $STEPLUT reports the cycles per step and direction output image from the lookup tables
+                                    // and from the bit by bit build they replace, for the step output mode of the board map.
+//#define LASER_RASTER_ENABLE     1 // Raster engraving, $RASTER=<steps per pixel>,<hex pixels> arms a scanline of laser power levels
+                                    // output in hardware, paced by X axis step pulses. $RASTERTEST checks the output with simulated steps.
+//#define LASER_VELOCITY_ENABLE   1 // Scale laser power with velocity in hardware for M3 in laser mode, from the measured step rate of
+                                    // the dominant axis. Opt-in by $450. Requires one spare PIO state machine and two DMA channels.
+//#define SPINDLE_SYNC_ENABLE     1 // Spindle encoder with index pulse for RPM reporting and spindle synchronized motion (G33, G76).
+                                    // Pulse and index inputs are assigned from the aux inputs by the board map, set encoder PPR with $38.
+//#define SPINDLE_PID_ENABLE      1 // Closed loop PWM spindle speed from a tach input counted by a PWM slice, the tach input is assigned
+                                    // from the aux inputs by the board map. Set tach PPR with $38, PID gains with $80 - $82.
+//#define OUT_SR_REFRESH_ENABLE   1 // Periodically rewrite the output shift register from its shadow register by DMA, for boards with
+                                    // an output shift register. Requires two DMA channels and a DMA timer.
+//#define LIMIT_LATCH_ENABLE      1 // Latch the step position at the homing switch edge and correct the homed position for the distance
+                                    // travelled until the trip is confirmed, for repeatable homing at higher rates. $LIMLATCH reports it.
+//#define SYS_CLOCK_KHZ      200000 // System clock in kHz set at boot, default 125000. PIO, PWM and peripheral clocks are derived from it,
+                                    // $CLOCKS reports them. Core voltage is raised to 1.15V above 200 MHz.
+//#define STEP_PULSE_AXIS_ENABLE  1 // Per axis step pulse length and direction to step delay settings, 0 uses $0 and $29.
+                                    // Requires N_AXIS pin PIO step outputs, not available with step streaming.
+//#define STEP_FOLLOWER_ENABLE    1 // Follow a step/dir input on an axis with a gear ratio, $FOLLOW=<axis>,<num>,<den> starts and
+                                    // $FOLLOW=OFF stops. Inputs are assigned from the aux inputs by the board map, requires STEP_INJECT_ENABLE.
+                                    // Not for high rate input: output is limited to one step per $29 + 2 x $0 microseconds when idle
+                                    // (50 kHz at the defaults) and one step per stepper tick during motion, and lags the input by up to
+                                    // FOLLOWER_PERIOD (100) microseconds plus the output time of the queued steps. $FOLLOW reports the limit.
+//#define STEP_GATE_ENABLE        1 // Block step pulses in the PIO step programs while the E-stop input is active, set STEP_GATE_PIN
+                                    // to use another control or a limit input. $STEPGATE reports suppressed pulses, $STEPGATE=R clears.
+//#define SYNC_OUTPUT_ENABLE      1 // Apply synchronized aux output changes (M62, M63) at the step tick they belong to when step
+                                    // streaming, instead of when the tick is generated up to two blocks ahead. Requires STEP_STREAM_ENABLE.
 
 
 // Optional control signals:
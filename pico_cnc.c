@@ -58,6 +58,8 @@ static void digital_out (uint8_t port, bool on)
 
         state[port] = on;
 
+        out_sr_hold();
+
         switch(port)
         {
             case 0:
@@ -98,7 +100,8 @@ static void digital_out (uint8_t port, bool on)
                 break;
         }
 
-        out_sr16_write(pio1, 1, sr->value);
+        out_sr_update();
+        out_sr_release();
     }
 }
 
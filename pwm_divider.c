@@ -0,0 +1,145 @@
+/*
+  pwm_divider.c - PWM clock divider and wrap selection for maximum resolution at the requested frequency
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+
+#include "hardware/clocks.h"
+
+#include "driver.h"
+#include "pwm_divider.h"
+#include "grbl/nuts_bolts.h"
+
+#define PWM_DIV16_MIN 16        // 1.0
+#define PWM_DIV16_MAX 4095      // 255 + 15/16
+#define PWM_TOP_MAX   65536
+
+#define PWM_SELFTEST_POINTS 2000
+
+// The counter clock is the system clock divided by div16 / 16, the period is top counts.
+// The smallest divider that keeps top within 16 bits gives the highest resolution, larger dividers are tried
+// as long as the resolution in whole bits is kept and the one with the smallest frequency error is selected.
+bool pwm_divider_solve (uint32_t sys_clock_hz, float freq, pwm_divider_t *pwm)
+{
+    double product, err, best_err = 0.0; // product is div16 * top for the exact frequency
+    uint32_t div16, top, best_div16 = 0, best_top = 0;
+    uint_fast8_t bits = 0;
+
+    if(!(freq > 0.0f))
+        return false;
+
+    product = (double)sys_clock_hz * 16.0 / (double)freq;
+
+    if(product < (double)(PWM_DIV16_MIN * 2) || product > (double)PWM_DIV16_MAX * (double)PWM_TOP_MAX)
+        return false;
+
+    div16 = (uint32_t)ceil(product / (double)PWM_TOP_MAX);
+    if(div16 < PWM_DIV16_MIN)
+        div16 = PWM_DIV16_MIN;
+
+    for(; div16 <= PWM_DIV16_MAX; div16++) {
+
+        if((top = (uint32_t)(product / (double)div16 + 0.5)) > PWM_TOP_MAX)
+            top = PWM_TOP_MAX;
+
+        if(top < 2 || (best_top && (31 - __builtin_clz(top)) < bits))
+            break;
+
+        err = fabs((double)div16 * (double)top - product);
+
+        if(best_top == 0 || err < best_err) {
+            if(best_top == 0)
+                bits = 31 - __builtin_clz(top);
+            best_err = err;
+            best_div16 = div16;
+            best_top = top;
+            if(err == 0.0)
+                break;
+        }
+    }
+
+    pwm->div16 = best_div16;
+    pwm->top = best_top;
+    pwm->bits = bits;
+    pwm->freq = (float)((double)sys_clock_hz * 16.0 / ((double)best_div16 * (double)best_top));
+    // The core computes the period as clock / frequency truncated, wrap is set to the period.
+    pwm->clock_hz = (uint32_t)(((double)best_top - 0.5) * (double)freq);
+
+    return true;
+}
+
+#if PWM_SELFTEST_ENABLE
+
+// $PWMTEST - runs the solver over the full frequency range at the current system clock, from the lowest frequency
+// reachable with a 16 bit wrap and the largest divider up to a period of 4 counts. Checks divider and wrap limits,
+// that no resolution is given away, the frequency error and the period computed by the core from clock_hz.
+// Reports the number of frequencies tested, the largest frequency error in ppm and the result.
+status_code_t pwm_divider_selftest (sys_state_t state)
+{
+    bool ok = true;
+    uint_fast16_t idx;
+    float err_max = 0.0f;
+    uint32_t sys_clock_hz = clock_get_hz(clk_sys);
+    double f_min = (double)sys_clock_hz * 16.0 / ((double)PWM_DIV16_MAX * (double)PWM_TOP_MAX),
+           f_max = (double)sys_clock_hz / 4.0;
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    for(idx = 0; idx < PWM_SELFTEST_POINTS && ok; idx++) {
+
+        pwm_divider_t pwm;
+        float freq = (float)(f_min * pow(f_max / f_min, (double)idx / (double)(PWM_SELFTEST_POINTS - 1)));
+        double product = (double)sys_clock_hz * 16.0 / (double)freq, err;
+
+        if(freq < f_min) // rounding to float
+            freq = nextafterf(freq, f_max);
+
+        if(!(ok = pwm_divider_solve(sys_clock_hz, freq, &pwm)))
+            break;
+
+        ok = pwm.div16 >= PWM_DIV16_MIN && pwm.div16 <= PWM_DIV16_MAX && pwm.top >= 2 && pwm.top <= PWM_TOP_MAX;
+
+        // At least 15 bits when the smallest divider is not limiting, else the full count at the smallest divider.
+        if(product >= (double)(PWM_DIV16_MIN * PWM_TOP_MAX))
+            ok = ok && pwm.bits >= 15;
+        else
+            ok = ok && pwm.div16 == PWM_DIV16_MIN;
+
+        // Frequency within half a count of the period.
+        err = fabs((double)pwm.freq - (double)freq) / (double)freq;
+        ok = ok && err <= 0.5 / (double)pwm.top + 1e-6;
+
+        // Period as computed by the core PWM precompute functions.
+        ok = ok && (uint32_t)((float)pwm.clock_hz / freq) == pwm.top - 1;
+
+        if(err * 1e6 > err_max)
+            err_max = (float)(err * 1e6);
+    }
+
+    hal.stream.write("[PWMTEST:");
+    hal.stream.write(uitoa(idx));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(err_max, 1));
+    hal.stream.write(ok ? ",OK" : ",FAIL");
+    hal.stream.write("]" ASCII_EOL);
+
+    return ok ? Status_OK : Status_SelfTestFailed;
+}
+
+#endif // PWM_SELFTEST_ENABLE
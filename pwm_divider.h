@@ -0,0 +1,41 @@
+/*
+  pwm_divider.h - PWM clock divider and wrap selection for maximum resolution at the requested frequency
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PWM_DIVIDER_H__
+#define __PWM_DIVIDER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "grbl/hal.h"
+
+typedef struct {
+    uint32_t div16;     // Clock divider in 8.4 fixed point format, 16 - 4095
+    uint32_t top;       // Counts per period, wrap + 1
+    uint32_t clock_hz;  // Counter clock to pass to the core PWM precompute functions, gives a period of top - 1
+    uint8_t bits;       // Resolution in whole bits
+    float freq;         // Achieved frequency
+} pwm_divider_t;
+
+bool pwm_divider_solve (uint32_t sys_clock_hz, float freq, pwm_divider_t *pwm);
+#if PWM_SELFTEST_ENABLE
+status_code_t pwm_divider_selftest (sys_state_t state);
+#endif
+
+#endif // __PWM_DIVIDER_H__
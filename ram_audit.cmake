@@ -0,0 +1,135 @@
+#
+# ram_audit.cmake - checks the linker map that interrupt handlers and functions called from interrupt context are linked to RAM.
+#
+# Part of grblHAL
+#
+# Invoked by the ram_audit target: cmake -DMAP_FILE=<path to grblHAL.elf.map> -P ram_audit.cmake
+#
+# Functions marked __not_in_flash_func() are placed in .time_critical.<name> sections, functions left in flash in .text.<name> sections.
+# Functions are listed as <source file>:<name> and only matched in the object file compiled from the source file.
+# Functions that are inlined by the compiler have no section of their own and are not reported.
+# NOTE: code in the grbl core, plugins and the Pico SDK called from interrupt context is not checked.
+#
+
+set(RAM_FUNCS
+# driver.c - stepper interrupt
+ driver.c:stepper_int_handler
+ driver.c:stepperPulseStart
+ driver.c:stepperSetDirOutputs
+ driver.c:stepperGoIdle
+ driver.c:stepperEnable
+ driver.c:stepperCyclesPerTick
+ driver.c:stepperOutputStep
+ driver.c:stepper_inject_step
+ driver.c:stepperInjectDrain
+ driver.c:stepperInjectDrainStart
+ driver.c:stepperInjectPosition
+ driver.c:step_stream_dma_handler
+ driver.c:stepStreamPulseStart
+ driver.c:stepStreamGoIdle
+ driver.c:stepStreamCyclesPerTick
+ driver.c:stepStreamFill
+ driver.c:stepStreamTick
+ driver.c:stepStreamDirImage
+ driver.c:syncDigitalOut
+ driver.c:syncOutputMark
+ driver.c:sync_output_irq
+ driver.c:syncOutputDrain
+ driver.c:syncOutputFlush
+ driver.c:probeGetState
+ driver.c:probe_latch_freeze
+ driver.c:probe_latch_stop
+ driver.c:spindleSetSpeed
+ driver.c:spindlePulseOn
+ driver.c:timing_add
+ driver.c:timing_get_cycles
+ driver.c:bitsSetAtomic
+ driver.c:bitsClearAtomic
+ driver.c:valueSetAtomic
+ driver.c:out_sr_hold
+ driver.c:out_sr_update
+ driver.c:out_sr_release
+ driver.c:out_sr_flush_irq
+# driver.c - GPIO interrupts and debounce alarms
+ driver.c:gpio_irq_handler
+ driver.c:gpio_int_handler
+ driver.c:gpio_irq_enable
+ driver.c:limit_debounce_callback
+ driver.c:limit_latch_trip
+ driver.c:srLatch_debounce_callback
+ driver.c:limitsGetState
+ driver.c:systemGetState
+ driver.c:isr_systick
+# axis_encoder.c
+ axis_encoder.c:encoders_check
+ axis_encoder.c:encodersCyclesPerTick
+ axis_encoder.c:encodersGoIdle
+# stepper_dda.c
+ stepper_dda.c:stepper_dda_load
+# laser_raster.c
+ laser_raster.c:laser_raster_stop
+ laser_raster.c:laser_raster_active
+# laser_velocity.c
+ laser_velocity.c:laser_velocity_set_level
+ laser_velocity.c:laser_velocity_enable
+ laser_velocity.c:laserVelocityPulseStart
+ laser_velocity.c:build_table
+ laser_velocity.c:velocity_start
+ laser_velocity.c:velocity_stop
+# spindle_encoder.c
+ spindle_encoder.c:spindle_index_irq
+ spindle_encoder.c:encoder_get_count
+ spindle_encoder.c:spindleGetData
+ spindle_encoder.c:spindleSyncPulseStart
+# spindle_pid.c
+ spindle_pid.c:spindle_pid_update
+# step_follower.c
+ step_follower.c:follower_irq
+ step_follower.c:follower_stepper_enable
+# ioports.c
+ ioports.c:ioports_event
+# serial.c
+ serial.c:uart_interrupt_handler
+ serial.c:uart1_interrupt_handler
+# usb_serial.c
+ usb_serial.c:low_priority_worker_irq
+)
+
+if(NOT MAP_FILE)
+    message(FATAL_ERROR "ram_audit: MAP_FILE not set")
+endif()
+
+if(NOT EXISTS ${MAP_FILE})
+    message(FATAL_ERROR "ram_audit: ${MAP_FILE} not found")
+endif()
+
+file(READ ${MAP_FILE} map)
+
+# Skip the discarded input sections list
+string(FIND "${map}" "Linker script and memory map" pos)
+if(pos GREATER -1)
+    string(SUBSTRING "${map}" ${pos} -1 map)
+endif()
+
+set(in_flash "")
+
+foreach(entry ${RAM_FUNCS})
+    string(REPLACE ":" ";" entry ${entry})
+    list(GET entry 0 src)
+    list(GET entry 1 func)
+    string(REPLACE "." "\\." src ${src})
+    # The input section name is followed by its address, size and object file. Names longer than the
+    # section name column are followed by a line break. Static functions with the same name in other
+    # objects, e.g. in the grbl core or the Pico SDK, are not matched.
+    string(REGEX MATCH "[ \t\n]\\.text\\.${func}[ \t\r\n]+0x[0-9a-fA-F]+[ \t]+0x[0-9a-fA-F]+[ \t]+[^\r\n]*[/\\(]${src}\\.o(bj)?[ \t\r\n)]" found "${map}")
+    if(found)
+        list(APPEND in_flash ${func})
+    endif()
+endforeach()
+
+if(in_flash)
+    string(REPLACE ";" ", " in_flash "${in_flash}")
+    message(FATAL_ERROR "ram_audit: functions called from interrupt context linked to flash: ${in_flash}")
+endif()
+
+message(STATUS "ram_audit: OK")
@@ -368,7 +368,7 @@ static const io_stream_t *serialInit (uint32_t baud_rate)
     return &stream;           
 }
 
-static void uart_interrupt_handler(void)
+static void __not_in_flash_func(uart_interrupt_handler)(void)
 {
     uint32_t data, ctrl = UART->mis;
 
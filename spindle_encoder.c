@@ -0,0 +1,259 @@
+/*
+  spindle_encoder.c - PIO spindle encoder with index pulse capture for RPM reporting and spindle synchronized motion
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if SPINDLE_ENCODER_ENABLE
+
+#include "pico/time.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "driverPIO.pio.h"
+#include "grbl/protocol.h"
+#include "grbl/report.h"
+#include "grbl/nuts_bolts.h"
+#if SPINDLE_SYNC_ENABLE
+#include "grbl/pid.h"
+#endif
+
+#define SPINDLE_ENCODER_TIMEOUT 2000000 // Spindle is reported stopped when no index pulse is seen for this long, in microseconds
+
+// Pulses and index pulses are counted by the spindle_encoder state machine, the pulse count is reset by the index pulse
+// so the angular position is available without any processing per pulse. The index interrupt flag raised by the state
+// machine is serviced once per revolution to timestamp the index pulse, RPM is derived from the index pulse period.
+// The counters are copied out by injecting instructions, a hardware spin lock serializes access from the stepper
+// interrupt and the foreground process - which may run on different cores.
+static struct {
+    PIO pio;
+    uint sm;
+    spin_lock_t *lock;
+    uint16_t ppr;
+    float pulse_distance;       // Revolutions per pulse
+    uint32_t index_base;        // Index count at last reset
+    volatile uint32_t index_time;
+    volatile uint32_t index_period;
+} encoder = {0};
+
+static spindle_data_t spindle_data = {0};
+static on_spindle_programmed_ptr on_spindle_programmed;
+
+#if SPINDLE_SYNC_ENABLE
+
+static struct {
+    volatile bool active;
+    bool sync;
+    float prev_pos;
+    float steps_per_mm;
+    float programmed_rate;
+    float block_start;
+    uint32_t segment_id;
+    uint32_t min_cycles_per_tick;
+    pidf_t pid;
+    stepper_pulse_start_ptr pulse_start;
+} tracker = {0};
+
+#endif
+
+static void __not_in_flash_func(spindle_index_irq)(void)
+{
+    uint32_t now = time_us_32();
+
+    pio_interrupt_clear(encoder.pio, 1);
+
+    encoder.index_period = now - encoder.index_time;
+    encoder.index_time = now;
+}
+
+static void __not_in_flash_func(encoder_get_count)(uint32_t *index, uint32_t *pulses)
+{
+    uint32_t irq_state = spin_lock_blocking(encoder.lock);
+
+    spindle_encoder_get_count(encoder.pio, encoder.sm, index, pulses);
+
+    spin_unlock(encoder.lock, irq_state);
+}
+
+static spindle_data_t *__not_in_flash_func(spindleGetData)(spindle_data_request_t request)
+{
+    uint32_t index, pulses;
+
+    if(encoder.ppr != settings.spindle.ppr) {
+        encoder.ppr = settings.spindle.ppr;
+        encoder.pulse_distance = encoder.ppr ? 1.0f / (float)encoder.ppr : 0.0f;
+    }
+
+    switch(request) {
+
+        case SpindleData_Counters:
+            encoder_get_count(&index, &pulses);
+            spindle_data.index_count = index - encoder.index_base;
+            spindle_data.pulse_count = spindle_data.index_count * encoder.ppr + pulses;
+            spindle_data.error_count = 0;
+            break;
+
+        case SpindleData_RPM:
+            {
+                uint32_t period = encoder.index_period, elapsed = time_us_32() - encoder.index_time;
+
+                // Reported RPM decays when the next index pulse is late, e.g. when the spindle is stopping.
+                if(period == 0 || period > SPINDLE_ENCODER_TIMEOUT || elapsed > SPINDLE_ENCODER_TIMEOUT)
+                    spindle_data.rpm = 0.0f;
+                else
+                    spindle_data.rpm = 60000000.0f / (float)(elapsed > period ? elapsed : period);
+            }
+            break;
+
+        case SpindleData_AngularPosition:
+            encoder_get_count(&index, &pulses);
+            spindle_data.angular_position = (float)(int32_t)(index - encoder.index_base) + (float)pulses * encoder.pulse_distance;
+            break;
+    }
+
+    return &spindle_data;
+}
+
+// Waits up to a second for the next index pulse if the spindle is running so that positions are counted from the index.
+static void spindleDataReset (void)
+{
+    uint32_t index, pulses, timeout = hal.get_elapsed_ticks() + 1000;
+
+    encoder_get_count(&index, &pulses);
+
+    if(spindleGetData(SpindleData_RPM)->rpm > 0.0f) {
+        uint32_t start = index;
+        while(index == start && hal.get_elapsed_ticks() <= timeout)
+            encoder_get_count(&index, &pulses);
+    }
+
+    encoder.index_base = index;
+
+#if SPINDLE_SYNC_ENABLE
+    if(pidf_config_changed(&tracker.pid, &settings.position.pid))
+        pidf_init(&tracker.pid, &settings.position.pid);
+
+    tracker.min_cycles_per_tick = hal.f_step_timer / (uint32_t)(settings.axis[Z_AXIS].max_rate * settings.axis[Z_AXIS].steps_per_mm / 60.0f);
+#endif
+}
+
+static void onSpindleProgrammed (spindle_ptrs_t *spindle, spindle_state_t state, float rpm, spindle_rpm_mode_t mode)
+{
+    if(on_spindle_programmed)
+        on_spindle_programmed(spindle, state, rpm, mode);
+
+    spindleDataReset();
+}
+
+#if SPINDLE_SYNC_ENABLE
+
+// Adjusts the step rate of spindle synchronized blocks at segment boundaries for the position error since
+// the previous segment, the spindle position is sampled when the segment is loaded.
+static void __not_in_flash_func(spindleSyncPulseStart)(stepper_t *stepper)
+{
+    if(stepper->new_block) {
+        if((tracker.active = stepper->exec_segment->spindle_sync)) {
+            tracker.sync = true;
+            tracker.programmed_rate = stepper->exec_block->programmed_rate;
+            tracker.steps_per_mm = stepper->exec_block->steps_per_mm;
+            tracker.segment_id = 0;
+            tracker.prev_pos = 0.0f;
+            tracker.block_start = spindleGetData(SpindleData_AngularPosition)->angular_position * tracker.programmed_rate;
+            pidf_reset(&tracker.pid);
+        }
+    }
+
+    tracker.pulse_start(stepper);
+
+    if(tracker.active && tracker.segment_id != stepper->exec_segment->id) {
+
+        tracker.segment_id = stepper->exec_segment->id;
+
+        if(!stepper->new_block) {
+            if(stepper->exec_segment->cruising) {
+
+                float dt = (float)hal.f_step_timer / (float)(stepper->exec_segment->cycles_per_tick * stepper->exec_segment->n_step);
+                float actual_pos = spindleGetData(SpindleData_AngularPosition)->angular_position * tracker.programmed_rate - tracker.block_start;
+
+                if(tracker.sync) {
+                    tracker.pid.sample_rate_prev = dt;
+                    tracker.sync = false;
+                }
+
+                int32_t step_delta = (int32_t)(pidf(&tracker.pid, tracker.prev_pos, actual_pos, dt) * tracker.steps_per_mm);
+                int32_t ticks = (((int32_t)stepper->step_count + step_delta) * (int32_t)stepper->exec_segment->cycles_per_tick) / (int32_t)stepper->step_count;
+
+                stepper->exec_segment->cycles_per_tick = (uint32_t)max(ticks, (int32_t)tracker.min_cycles_per_tick);
+                hal.stepper.cycles_per_tick(stepper->exec_segment->cycles_per_tick);
+            }
+            tracker.prev_pos = stepper->exec_segment->target_position;
+        }
+    }
+}
+
+#endif // SPINDLE_SYNC_ENABLE
+
+// Called from driver_init() after the aux inputs are registered and the driver state machines are claimed.
+void spindle_encoder_init (void)
+{
+    int sm;
+    PIO pio = pio0;
+
+    if(!(hal.port.get_pin_info && hal.port.claim))
+        return;
+
+    if(!(aux_input_claim(SPINDLE_PULSE_PIN, "Spindle pulse") && aux_input_claim(SPINDLE_INDEX_PIN, "Spindle index")))
+        return;
+
+    if(!pio_can_add_program(pio, &spindle_encoder_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+        pio = pio1;
+        if(!pio_can_add_program(pio, &spindle_encoder_program) || (sm = pio_claim_unused_sm(pio, false)) == -1) {
+            protocol_enqueue_foreground_task(report_plain, "Spindle encoder: no free PIO state machine");
+            return;
+        }
+    }
+
+    encoder.pio = pio;
+    encoder.sm = (uint)sm;
+    encoder.lock = spin_lock_init(spin_lock_claim_unused(true));
+
+    spindle_encoder_program_init(pio, encoder.sm, pio_add_program(pio, &spindle_encoder_program), SPINDLE_PULSE_PIN, SPINDLE_INDEX_PIN);
+
+    // Interrupt flag 1 is not used by other programs, it is routed to the second interrupt line of the PIO.
+    pio_interrupt_clear(pio, 1);
+    pio_set_irq1_source_enabled(pio, pis_interrupt1, true);
+    irq_set_exclusive_handler(pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1, spindle_index_irq);
+    irq_set_enabled(pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1, true);
+
+    hal.spindle_data.get = spindleGetData;
+    hal.spindle_data.reset = spindleDataReset;
+    hal.driver_cap.spindle_encoder = On;
+
+    on_spindle_programmed = grbl.on_spindle_programmed;
+    grbl.on_spindle_programmed = onSpindleProgrammed;
+
+#if SPINDLE_SYNC_ENABLE
+    hal.driver_cap.spindle_sync = On;
+
+    tracker.pulse_start = hal.stepper.pulse_start;
+    hal.stepper.pulse_start = spindleSyncPulseStart;
+#endif
+}
+
+#endif // SPINDLE_ENCODER_ENABLE
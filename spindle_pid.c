@@ -0,0 +1,149 @@
+/*
+  spindle_pid.c - closed loop PWM spindle speed control from a PWM slice counting spindle tach pulses
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if SPINDLE_PID_ENABLE
+
+#include <math.h>
+
+#include "hardware/pwm.h"
+#include "hardware/gpio.h"
+
+#include "grbl/pid.h"
+#include "grbl/protocol.h"
+#include "grbl/report.h"
+
+#define RPM_WINDOW 8 // Number of PID periods in the RPM measurement window, power of 2
+
+// The tach input is the B pin of a PWM slice running in rising edge counting mode, the free running 16 bit counter is
+// sampled by spindle_pid_update() from the systick interrupt every SPINDLE_PID_PERIOD milliseconds.
+// RPM is measured over the last RPM_WINDOW periods. The PID output is added to the programmed RPM before it is
+// converted to a PWM compare value, so linearization and the PWM limits of the spindle settings still apply.
+static struct {
+    uint slice;
+    uint16_t count;
+    uint_fast8_t idx;
+    uint16_t pulses[RPM_WINDOW];
+    uint32_t window;            // Pulses in the measurement window
+    uint16_t ppr;
+    float rpm_factor;           // RPM per pulse in the measurement window
+    volatile float rpm_programmed;
+    pidf_t pid;
+    spindle_pwm_t *pwm;
+} tach = {0};
+
+static spindle_data_t spindle_data = {0};
+
+// Called from the systick interrupt every SPINDLE_PID_PERIOD milliseconds.
+void __not_in_flash_func(spindle_pid_update)(void)
+{
+    if(tach.pwm == NULL)
+        return;
+
+    uint16_t count = (uint16_t)pwm_get_counter(tach.slice), pulses = count - tach.count;
+
+    tach.count = count;
+    tach.window += pulses - tach.pulses[tach.idx];
+    tach.pulses[tach.idx] = pulses;
+    tach.idx = (tach.idx + 1) & (RPM_WINDOW - 1);
+
+    if(tach.ppr != settings.spindle.ppr) {
+        tach.ppr = settings.spindle.ppr;
+        tach.rpm_factor = tach.ppr ? 60000.0f / (float)(tach.ppr * RPM_WINDOW * SPINDLE_PID_PERIOD) : 0.0f;
+    }
+
+    spindle_data.pulse_count += pulses;
+    spindle_data.rpm = (float)tach.window * tach.rpm_factor;
+
+    if(tach.rpm_programmed > 0.0f) {
+        float rpm = tach.rpm_programmed + pidf(&tach.pid, tach.rpm_programmed, spindle_data.rpm, 1000.0f / (float)SPINDLE_PID_PERIOD);
+        pwm_set_gpio_level(SPINDLE_PWM_PIN, tach.pwm->compute_value(tach.pwm, rpm, true));
+    }
+}
+
+// Called on spindle state changes, rpm is 0 when the spindle is off or in laser mode.
+void spindle_pid_set_rpm (float rpm)
+{
+    if(tach.pwm == NULL)
+        return;
+
+    if(pidf_config_changed(&tach.pid, &settings.spindle.pid))
+        pidf_init(&tach.pid, &settings.spindle.pid);
+
+    if(tach.rpm_programmed == 0.0f || rpm == 0.0f)
+        pidf_reset(&tach.pid);
+
+    tach.rpm_programmed = rpm;
+}
+
+// At speed when the measured RPM is within $340 percent of the programmed RPM, always when $340 is 0.
+bool spindle_pid_at_speed (void)
+{
+    float rpm = tach.rpm_programmed;
+
+    return settings.spindle.at_speed_tolerance <= 0.0f ||
+            fabsf(spindle_data.rpm - rpm) <= rpm * settings.spindle.at_speed_tolerance / 100.0f;
+}
+
+static spindle_data_t *spindlePidGetData (spindle_data_request_t request)
+{
+    UNUSED(request);
+
+    return &spindle_data;
+}
+
+static void spindlePidDataReset (void)
+{
+    spindle_data.pulse_count = 0;
+}
+
+// Called from driver_init() after the aux inputs are registered.
+void spindle_pid_init (spindle_pwm_t *pwm)
+{
+    pwm_config config;
+    uint slice = pwm_gpio_to_slice_num(SPINDLE_PULSE_PIN);
+
+    if(!(hal.port.get_pin_info && hal.port.claim))
+        return;
+
+    if(pwm_hw->en & (1u << slice)) {
+        protocol_enqueue_foreground_task(report_plain, "Spindle PID: tach input PWM slice in use");
+        return;
+    }
+
+    if(!aux_input_claim(SPINDLE_PULSE_PIN, "Spindle tach"))
+        return;
+
+    config = pwm_get_default_config();
+    pwm_config_set_clkdiv_mode(&config, PWM_DIV_B_RISING);
+    pwm_config_set_clkdiv_int(&config, 1);
+    pwm_init(slice, &config, true);
+    gpio_set_function(SPINDLE_PULSE_PIN, GPIO_FUNC_PWM);
+
+    tach.slice = slice;
+    tach.count = (uint16_t)pwm_get_counter(slice);
+    tach.pwm = pwm;
+
+    hal.spindle_data.get = spindlePidGetData;
+    hal.spindle_data.reset = spindlePidDataReset;
+    hal.driver_cap.spindle_pid = On;
+}
+
+#endif // SPINDLE_PID_ENABLE
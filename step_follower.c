@@ -0,0 +1,301 @@
+/*
+  step_follower.c - step/direction input follower, re-emits counted input steps on an axis with a gear ratio
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if STEP_FOLLOWER_ENABLE
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/time.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+
+#include "driverPIO.pio.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/planner.h"
+#include "grbl/gcode.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/report.h"
+
+#define FOLLOWER_RATIO_MAX 1000
+
+// Input step pulses are counted by a step_counter state machine without the probe freeze, signed by the direction input.
+// A hardware alarm polls the counter every FOLLOWER_PERIOD microseconds, the count delta is scaled by the gear ratio and the
+// resulting steps are queued with stepper_inject_step(), as many per poll as the queue accepts. Steps not accepted are kept
+// pending for the next poll. The stepper interrupt outputs one queued step per tick, merged with planned motion if running,
+// and updates the machine position as the step is output. The planner and parser positions are synced from it when the
+// machine is idle. Input is only followed in the idle, cycle and jog states, else it is discarded.
+// The output rate is limited by step injection to one step per $29 + 2 x $0 microseconds when idle, see stepper_inject_rate(),
+// and to one step per stepper tick during motion, held back while the planned motion steps the axis. Output lags the input
+// by up to a poll period plus the time to output the queued steps, input above the output rate accumulates as pending steps.
+static struct {
+    PIO pio;
+    uint sm;
+    uint alarm;
+    volatile bool active;
+    volatile bool moved;        // Steps queued since the last position sync
+    uint8_t axis;
+    axes_signals_t step;
+    axes_signals_t enable;      // Stepper enable signals as last requested by the core
+    int32_t num;
+    int32_t den;
+    uint32_t count;
+    int32_t acc;
+    volatile int32_t pending;
+    uint32_t target;
+} follower = {0};
+
+static stepper_enable_ptr stepper_enable;
+static on_unknown_sys_command_ptr on_unknown_sys_command;
+static on_execute_realtime_ptr on_execute_realtime;
+static on_reset_ptr on_reset;
+
+static void __not_in_flash_func(follower_irq)(void)
+{
+    uint32_t now = timer_hw->timerawl, count;
+    int32_t steps;
+    sys_state_t state = state_get();
+
+    timer_hw->intr = 1u << follower.alarm;
+
+    if(!follower.active)
+        return;
+
+    // Arm the next poll, restart from now if the poll is late.
+    if((int32_t)((follower.target += FOLLOWER_PERIOD) - now) <= 0)
+        follower.target = now + FOLLOWER_PERIOD;
+    timer_hw->alarm[follower.alarm] = follower.target;
+
+    count = (uint32_t)step_counter_get_count(follower.pio, follower.sm);
+
+    if(!(state == STATE_IDLE || (state & (STATE_CYCLE|STATE_JOG)))) {
+        follower.count = count;
+        follower.acc = follower.pending = 0;
+        return;
+    }
+
+    follower.acc += (int32_t)(count - follower.count) * follower.num;
+    follower.count = count;
+
+    steps = follower.acc / follower.den;
+    follower.acc -= steps * follower.den;
+    follower.pending += steps;
+
+    while(follower.pending > 0 && stepper_inject_step(follower.step, (axes_signals_t){0}, true)) {
+        follower.pending--;
+        follower.moved = true;
+    }
+
+    while(follower.pending < 0 && stepper_inject_step(follower.step, follower.step, true)) {
+        follower.pending++;
+        follower.moved = true;
+    }
+}
+
+// Keeps the followed axis enabled while following.
+static void __not_in_flash_func(follower_stepper_enable)(axes_signals_t enable)
+{
+    follower.enable = enable;
+
+    if(follower.active)
+        enable.mask |= follower.step.mask;
+
+    stepper_enable(enable);
+}
+
+static void follower_stop (void)
+{
+    bool active = follower.active;
+
+    follower.active = false;
+    hw_clear_bits(&timer_hw->inte, 1u << follower.alarm);
+    timer_hw->armed = 1u << follower.alarm;
+    follower.pending = 0;
+
+    if(active)
+        stepper_enable(follower.enable);
+}
+
+static void follower_start (uint_fast8_t axis, int32_t num, int32_t den)
+{
+    follower_stop();
+
+    follower.axis = axis;
+    follower.step.mask = bit(axis);
+    follower.num = num;
+    follower.den = den;
+    follower.acc = 0;
+    follower.count = (uint32_t)step_counter_get_count(follower.pio, follower.sm);
+    follower.target = timer_hw->timerawl + FOLLOWER_PERIOD;
+    follower.active = true;
+
+    stepper_enable((axes_signals_t){follower.enable.mask | follower.step.mask});
+
+    timer_hw->alarm[follower.alarm] = follower.target;
+    hw_set_bits(&timer_hw->inte, 1u << follower.alarm);
+}
+
+// Syncs the planner and parser positions to the machine position moved by the follower when idle.
+static void follower_sync (sys_state_t state)
+{
+    if(follower.moved && state == STATE_IDLE && plan_get_current_block() == NULL && !stepper_inject_pending()) {
+        follower.moved = false;
+        plan_sync_position();
+        gc_sync_position();
+    }
+
+    on_execute_realtime(state);
+}
+
+static void follower_reset (void)
+{
+    follower_stop();
+
+    if(on_reset)
+        on_reset();
+}
+
+// $FOLLOW=<axis>,<numerator>,<denominator> - follows the step/dir input on the axis with the gear ratio, output steps = input steps * numerator / denominator.
+// $FOLLOW=OFF stops following.
+static status_code_t follower_set (sys_state_t state, char *args)
+{
+    char *end;
+    uint_fast8_t axis;
+    int32_t num, den;
+
+    if(!strcmp(args, "OFF")) {
+        follower_stop();
+        return Status_OK;
+    }
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    for(axis = 0; axis < N_AXIS && *args != *axis_letter[axis]; axis++);
+
+    if(axis == N_AXIS || *++args != ',')
+        return Status_InvalidStatement;
+
+    num = strtol(args + 1, &end, 10);
+    if(end == args + 1 || *end != ',')
+        return Status_InvalidStatement;
+
+    args = end + 1;
+    den = strtol(args, &end, 10);
+    if(end == args || *end != '\0')
+        return Status_InvalidStatement;
+
+    if(num == 0 || abs(num) > FOLLOWER_RATIO_MAX || den <= 0 || den > FOLLOWER_RATIO_MAX)
+        return Status_InvalidStatement;
+
+    follower_start(axis, num, den);
+
+    return Status_OK;
+}
+
+// $FOLLOW - reports [FOLLOW:<axis|OFF>,<numerator>,<denominator>,<input count>,<pending steps>,<max idle output rate, Hz>,<poll period, us>]
+static status_code_t follower_command (sys_state_t state, char *line)
+{
+    status_code_t retval = Status_Unhandled;
+
+    if(!strcmp(line, "$FOLLOW")) {
+        hal.stream.write("[FOLLOW:");
+        hal.stream.write(follower.active ? axis_letter[follower.axis] : "OFF");
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)follower.num, 0));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(follower.den));
+        hal.stream.write(",");
+        // The counter is read by the poll interrupt only while following, a concurrent read would mix up the FIFO words.
+        hal.stream.write(ftoa((float)(int32_t)(follower.active ? follower.count : (uint32_t)step_counter_get_count(follower.pio, follower.sm)), 0));
+        hal.stream.write(",");
+        hal.stream.write(ftoa((float)follower.pending, 0));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(stepper_inject_rate()));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(FOLLOWER_PERIOD));
+        hal.stream.write("]" ASCII_EOL);
+        retval = Status_OK;
+    } else if(!strncmp(line, "$FOLLOW=", 8))
+        retval = follower_set(state, line + 8);
+
+    if(retval == Status_Unhandled && on_unknown_sys_command)
+        retval = on_unknown_sys_command(state, line);
+
+    return retval;
+}
+
+// Called from driver_init() after the aux inputs are registered and the driver state machines are claimed.
+void step_follower_init (void)
+{
+    int sm, offset, alarm;
+    PIO pio = pio0;
+
+    if(!(hal.port.get_pin_info && hal.port.claim && hal.stepper.enable))
+        return;
+
+    if(!(aux_input_claim(FOLLOWER_STEP_PIN, "Follower step") && aux_input_claim(FOLLOWER_DIR_PIN, "Follower dir")))
+        return;
+
+    if((sm = pio_claim_unused_sm(pio, false)) == -1 || (offset = step_counter_program_load(pio, NUM_BANK0_GPIOS)) == -1) {
+        if(sm != -1)
+            pio_sm_unclaim(pio, sm);
+        pio = pio1;
+        if((sm = pio_claim_unused_sm(pio, false)) == -1 || (offset = step_counter_program_load(pio, NUM_BANK0_GPIOS)) == -1) {
+            if(sm != -1)
+                pio_sm_unclaim(pio, sm);
+            protocol_enqueue_foreground_task(report_plain, "Step follower: no free PIO state machine");
+            return;
+        }
+    }
+
+    if((alarm = hardware_alarm_claim_unused(false)) == -1) {
+        pio_sm_unclaim(pio, sm);
+        protocol_enqueue_foreground_task(report_plain, "Step follower: no free hardware alarm");
+        return;
+    }
+
+    follower.pio = pio;
+    follower.sm = (uint)sm;
+    follower.alarm = (uint)alarm;
+
+    step_counter_program_init(pio, follower.sm, (uint)offset, FOLLOWER_STEP_PIN, FOLLOWER_DIR_PIN);
+    pio_sm_set_enabled(pio, follower.sm, true);
+
+    irq_set_exclusive_handler(TIMER_IRQ_0 + follower.alarm, follower_irq);
+    irq_set_enabled(TIMER_IRQ_0 + follower.alarm, true);
+
+    stepper_enable = hal.stepper.enable;
+    hal.stepper.enable = follower_stepper_enable;
+
+    on_unknown_sys_command = grbl.on_unknown_sys_command;
+    grbl.on_unknown_sys_command = follower_command;
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = follower_sync;
+
+    on_reset = grbl.on_reset;
+    grbl.on_reset = follower_reset;
+}
+
+#endif // STEP_FOLLOWER_ENABLE
@@ -0,0 +1,211 @@
+/*
+  stepper_dda.c - interpolator accelerated DDA (Bresenham) step generation
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if STEPPER_DDA_ENABLE
+
+#include <string.h>
+
+#include "pico/time.h"
+#include "hardware/clocks.h"
+
+#include "stepper_dda.h"
+#include "grbl/nuts_bolts.h"
+
+#define DDA_BENCHMARK_TICKS 100000
+
+typedef struct {
+    uint32_t step_event_count;
+    uint32_t steps[N_AXIS];
+    uint32_t counter[N_AXIS];
+} dda_reference_t;
+
+stepper_dda_t stepper_dda = {0};
+
+static void dda_interp_config (void)
+{
+    interp_config cfg = interp_default_config();
+
+    // Raw add of base to accumulator, written back on pop
+    interp_config_set_add_raw(&cfg, true);
+
+    interp_set_config(interp0, 0, &cfg);
+    interp_set_config(interp0, 1, &cfg);
+    interp_set_config(interp1, 0, &cfg);
+    interp_set_config(interp1, 1, &cfg);
+}
+
+// Configures the interpolators of the calling core, call from the core running the stepper interrupt.
+void stepper_dda_init (void)
+{
+    interp_claim_lane_mask(interp0, 0b11);
+    interp_claim_lane_mask(interp1, 0b11);
+
+    dda_interp_config();
+    stepper_dda_load((uint32_t[N_AXIS]){0}, 1, true);
+}
+
+// Loads the step counts of a new block or a segment with a different AMASS level. For a new block the accumulators
+// are set to half the step event count, as the plain Bresenham algorithm does. On a change of step event count mid block
+// the accumulators are adjusted to keep their offset relative to the step event count.
+void __not_in_flash_func(stepper_dda_load)(const uint32_t *steps, uint32_t step_event_count, bool new_block)
+{
+    int32_t adjust = new_block ? 0 : stepper_dda.step_event_count - (int32_t)step_event_count;
+
+    if(new_block) {
+        int32_t init = (int32_t)(step_event_count >> 1) - (int32_t)step_event_count - 1;
+        interp0->accum[0] = interp0->accum[1] = interp1->accum[0] = interp1->accum[1] = init;
+#if N_AXIS > 4
+        uint_fast8_t idx = N_AXIS - 4;
+        do {
+            stepper_dda.counter[--idx] = init;
+        } while(idx);
+#endif
+    } else if(adjust) {
+        interp0->accum[0] += adjust;
+        interp0->accum[1] += adjust;
+        interp1->accum[0] += adjust;
+        interp1->accum[1] += adjust;
+#if N_AXIS > 4
+        uint_fast8_t idx = N_AXIS - 4;
+        do {
+            stepper_dda.counter[--idx] += adjust;
+        } while(idx);
+#endif
+    }
+
+    stepper_dda.step_event_count = (int32_t)step_event_count;
+
+    interp0->base[0] = steps[X_AXIS];
+    interp0->base[1] = steps[Y_AXIS];
+    interp1->base[0] = steps[Z_AXIS];
+#if N_AXIS > 3
+    interp1->base[1] = steps[A_AXIS];
+#else
+    interp1->base[1] = 0;
+#endif
+#if N_AXIS > 4
+    stepper_dda.steps[0] = (int32_t)steps[B_AXIS];
+#endif
+#if N_AXIS > 5
+    stepper_dda.steps[1] = (int32_t)steps[C_AXIS];
+#endif
+}
+
+// Plain C counterpart of stepper_dda_tick().
+static inline __attribute__((always_inline)) axes_signals_t dda_reference_tick (dda_reference_t *dda)
+{
+    uint_fast8_t idx = N_AXIS;
+    axes_signals_t step = {0};
+
+    do {
+        idx--;
+        if((dda->counter[idx] += dda->steps[idx]) > dda->step_event_count) {
+            dda->counter[idx] -= dda->step_event_count;
+            step.mask |= bit(idx);
+        }
+    } while(idx);
+
+    return step;
+}
+
+static uint32_t __not_in_flash_func(dda_benchmark_reference)(dda_reference_t *dda, uint32_t *checksum)
+{
+    uint32_t ticks = DDA_BENCHMARK_TICKS, sum = 0, t = time_us_32();
+
+    do {
+        sum = sum * 31 + dda_reference_tick(dda).mask;
+    } while(--ticks);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+static uint32_t __not_in_flash_func(dda_benchmark_interp)(uint32_t *checksum)
+{
+    uint32_t ticks = DDA_BENCHMARK_TICKS, sum = 0, t = time_us_32();
+
+    do {
+        sum = sum * 31 + stepper_dda_tick().mask;
+    } while(--ticks);
+
+    t = time_us_32() - t;
+    *checksum = sum;
+
+    return t;
+}
+
+static void dda_benchmark_report (const char *name, uint32_t us)
+{
+    hal.stream.write("[STEPDDA:");
+    hal.stream.write(name);
+    hal.stream.write(",");
+    hal.stream.write(ftoa((float)us * (float)(clock_get_hz(clk_sys) / 1000000UL) / (float)DDA_BENCHMARK_TICKS, 1));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// $STEPDDA - runs the interpolator and plain C DDA over the same step counts and reports the mean number of
+// system clock cycles per step event, including loop overhead. Runs on the calling core, interpolator state is preserved.
+status_code_t stepper_dda_benchmark (sys_state_t state)
+{
+    static const uint32_t step_event_count = 10000;
+    static const uint32_t steps[] = { 10000, 7071, 3333, 1429, 1, 5000 };
+
+    uint_fast8_t idx;
+    uint32_t t_ref, t_interp, sum_ref, sum_interp, base[N_AXIS];
+    dda_reference_t dda;
+    stepper_dda_t dda_save;
+    interp_hw_save_t interp0_save, interp1_save;
+
+    if(state != STATE_IDLE)
+        return Status_IdleError;
+
+    dda.step_event_count = step_event_count;
+    for(idx = 0; idx < N_AXIS; idx++) {
+        base[idx] = dda.steps[idx] = steps[idx];
+        dda.counter[idx] = step_event_count >> 1;
+    }
+
+    t_ref = dda_benchmark_reference(&dda, &sum_ref);
+
+    interp_save(interp0, &interp0_save);
+    interp_save(interp1, &interp1_save);
+    memcpy(&dda_save, &stepper_dda, sizeof(stepper_dda_t));
+
+    dda_interp_config();
+    stepper_dda_load(base, step_event_count, true);
+    t_interp = dda_benchmark_interp(&sum_interp);
+
+    memcpy(&stepper_dda, &dda_save, sizeof(stepper_dda_t));
+    interp_restore(interp0, &interp0_save);
+    interp_restore(interp1, &interp1_save);
+
+    dda_benchmark_report("C", t_ref);
+    dda_benchmark_report("INTERP", t_interp);
+    hal.stream.write("[STEPDDA:CHECKSUM,");
+    hal.stream.write(sum_ref == sum_interp ? "OK" : "FAIL");
+    hal.stream.write("]" ASCII_EOL);
+
+    return sum_ref == sum_interp ? Status_OK : Status_SelfTestFailed;
+}
+
+#endif // STEPPER_DDA_ENABLE
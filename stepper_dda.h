@@ -0,0 +1,88 @@
+/*
+  stepper_dda.h - interpolator accelerated DDA (Bresenham) step generation
+
+  Part of grblHAL
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __STEPPER_DDA_H__
+#define __STEPPER_DDA_H__
+
+#include "hardware/interp.h"
+
+#include "grbl/hal.h"
+
+// The step accumulators of axes 0 - 3 are lanes 0 and 1 of interp0 and interp1 of the core running the stepper interrupt,
+// remaining axes are handled in software. Lanes are configured to add their base to the accumulator on each pop.
+// Accumulators are kept offset by -(step_event_count + 1) so that a step is due when the accumulator is not negative,
+// this gives the same step sequence as the usual counter > step_event_count comparison.
+
+typedef struct {
+    int32_t step_event_count;
+#if N_AXIS > 4
+    int32_t steps[N_AXIS - 4];
+    int32_t counter[N_AXIS - 4];
+#endif
+} stepper_dda_t;
+
+extern stepper_dda_t stepper_dda;
+
+void stepper_dda_init (void);
+void stepper_dda_load (const uint32_t *steps, uint32_t step_event_count, bool new_block);
+status_code_t stepper_dda_benchmark (sys_state_t state);
+
+// Advances the DDA by one step event, returns the axes to step.
+// Must be called from the core that called stepper_dda_init(), the interpolators are core local.
+static inline __attribute__((always_inline)) axes_signals_t stepper_dda_tick (void)
+{
+    int32_t acc;
+    axes_signals_t step = {0};
+
+    // Popping lane 0 writes both lane results back to the accumulators.
+    if((acc = (int32_t)interp0->pop[0]) >= 0) {
+        interp0->accum[0] = acc - stepper_dda.step_event_count;
+        step.x = On;
+    }
+    if((acc = (int32_t)interp0->accum[1]) >= 0) {
+        interp0->accum[1] = acc - stepper_dda.step_event_count;
+        step.y = On;
+    }
+    if((acc = (int32_t)interp1->pop[0]) >= 0) {
+        interp1->accum[0] = acc - stepper_dda.step_event_count;
+        step.z = On;
+    }
+#if N_AXIS > 3
+    if((acc = (int32_t)interp1->accum[1]) >= 0) {
+        interp1->accum[1] = acc - stepper_dda.step_event_count;
+        step.a = On;
+    }
+#endif
+#if N_AXIS > 4
+    if((stepper_dda.counter[0] += stepper_dda.steps[0]) >= 0) {
+        stepper_dda.counter[0] -= stepper_dda.step_event_count;
+        step.b = On;
+    }
+#endif
+#if N_AXIS > 5
+    if((stepper_dda.counter[1] += stepper_dda.steps[1]) >= 0) {
+        stepper_dda.counter[1] -= stepper_dda.step_event_count;
+        step.c = On;
+    }
+#endif
+
+    return step;
+}
+
+#endif // __STEPPER_DDA_H__
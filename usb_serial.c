@@ -74,7 +74,7 @@ static mutex_t usb_mutex;
 
 static void execute_realtime (uint_fast16_t state);
 
-static void low_priority_worker_irq (void)
+static void __not_in_flash_func(low_priority_worker_irq)(void)
 {
     // if the mutex is already owned, then we are in user code
     // in this file which will do a tud_task itself, so we'll just do nothing